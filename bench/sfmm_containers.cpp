@@ -0,0 +1,196 @@
+/*
+ * Container benchmark for the C++ adapters in sfmm_allocator.hpp.
+ *
+ * Runs the same std::vector, std::map, std::unordered_map and std::string workloads with four
+ * allocators and reports the time each one takes:
+ *
+ *     std        std::allocator (operator new, so the C library's malloc)
+ *     sf         sf::allocator
+ *     pmr-new    std::pmr containers on std::pmr::new_delete_resource()
+ *     pmr-sf     std::pmr containers on sf::resource()
+ *
+ * Every workload is seeded, so each allocator sees exactly the same calls, and computes a checksum
+ * that has to come out the same for all of them.  The heap of sf_mem_grow is only ~100KB, so the
+ * benchmark puts the heap on the SF_PAGES_MMAP page provider first.
+ *
+ * usage: bin/sfmm_containers [-n elements] [-r rounds]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "sfmm_allocator.hpp"
+
+#define HEAP_CAPACITY ((size_t)4 << 30)
+#define HEAP_PAGE_SIZE 65536
+
+template <class Alloc, class T>
+using rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+struct alignas(64) cache_line {
+    long value;
+};
+
+/*
+ * Builds vectors of n ints by push_back, so they grow through every capacity on the way, and
+ * vectors of cache line aligned structs, which take the sf_memalign path.
+ */
+template <class Alloc>
+static unsigned long vector_workload(const Alloc &alloc, long n, int rounds) {
+    unsigned long checksum = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (long length = 1; length <= 16 * n; length *= 2) {
+            std::vector<int, rebind<Alloc, int>> values{rebind<Alloc, int>(alloc)};
+            for (long i = 0; i < length; i++) values.push_back((int)i);
+            checksum += values.size() + (unsigned long)values.back();
+        }
+        std::vector<cache_line, rebind<Alloc, cache_line>> lines{rebind<Alloc, cache_line>(alloc)};
+        for (long i = 0; i < n / 16; i++) lines.push_back(cache_line{i});
+        checksum += lines.size() + (unsigned long)lines.back().value;
+    }
+    return checksum;
+}
+
+/*
+ * Inserts n random keys into a map, looks all of them up and erases every other one.
+ */
+template <class Map>
+static unsigned long map_workload(Map &map, long n, unsigned seed) {
+    std::mt19937 random(seed);
+    std::vector<int> keys((size_t)n);
+    for (auto &key : keys) key = (int)(random() % (unsigned)(4 * n));
+
+    unsigned long checksum = 0;
+    for (int key : keys) map[key] = key / 2;
+    for (int key : keys) checksum += (unsigned long)map.find(key)->second;
+    for (long i = 0; i < n; i += 2) map.erase(keys[(size_t)i]);
+    return checksum + map.size();
+}
+
+template <class Alloc>
+static unsigned long ordered_map_workload(const Alloc &alloc, long n, int rounds) {
+    using value = std::pair<const int, int>;
+    unsigned long checksum = 0;
+    for (int round = 0; round < rounds; round++) {
+        std::map<int, int, std::less<int>, rebind<Alloc, value>> map{rebind<Alloc, value>(alloc)};
+        checksum += map_workload(map, n, (unsigned)round);
+    }
+    return checksum;
+}
+
+template <class Alloc>
+static unsigned long unordered_map_workload(const Alloc &alloc, long n, int rounds) {
+    using value = std::pair<const int, int>;
+    unsigned long checksum = 0;
+    for (int round = 0; round < rounds; round++) {
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, rebind<Alloc, value>> map{rebind<Alloc, value>(alloc)};
+        checksum += map_workload(map, n, (unsigned)round);
+    }
+    return checksum;
+}
+
+/*
+ * Builds n strings of random lengths, most of them too long for the small string buffer, by
+ * appending to them piece by piece, then joins them two by two.
+ */
+template <class Alloc>
+static unsigned long string_workload(const Alloc &alloc, long n, int rounds) {
+    using string = std::basic_string<char, std::char_traits<char>, rebind<Alloc, char>>;
+    unsigned long checksum = 0;
+    for (int round = 0; round < rounds; round++) {
+        std::mt19937 random((unsigned)round);
+        std::vector<string, rebind<Alloc, string>> strings{rebind<Alloc, string>(alloc)};
+        strings.reserve((size_t)n);
+        for (long i = 0; i < n; i++) {
+            strings.emplace_back();
+            size_t pieces = 1 + random() % 8;
+            for (size_t piece = 0; piece < pieces; piece++) strings.back().append(1 + random() % 24, (char)('a' + piece));
+        }
+        for (long i = 0; i + 1 < n; i += 2) {
+            string joined = strings[(size_t)i] + strings[(size_t)i + 1];
+            checksum += joined.size();
+        }
+    }
+    return checksum;
+}
+
+typedef struct workload_result {
+    double seconds;
+    unsigned long checksum;
+} workload_result;
+
+template <class Alloc>
+static workload_result run_workload(int workload, const Alloc &alloc, long n, int rounds) {
+    auto start = std::chrono::steady_clock::now();
+    unsigned long checksum = 0;
+    switch (workload) {
+    case 0: checksum = vector_workload(alloc, n, rounds); break;
+    case 1: checksum = ordered_map_workload(alloc, n, rounds); break;
+    case 2: checksum = unordered_map_workload(alloc, n, rounds); break;
+    case 3: checksum = string_workload(alloc, n, rounds); break;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), checksum};
+}
+
+int main(int argc, char *argv[]) {
+    long n = 100000;
+    int rounds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+        case 'n': n = atol(optarg); break;
+        case 'r': rounds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n elements] [-r rounds]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (n < 2) n = 2;
+    if (rounds < 1) rounds = 1;
+
+    sf_page_config config = {SF_PAGES_MMAP, HEAP_PAGE_SIZE, HEAP_CAPACITY, NULL, NULL};
+    if (!sf_set_page_provider(&config)) {
+        fprintf(stderr, "could not set up the heap\n");
+        return EXIT_FAILURE;
+    }
+
+    const char *workloads[] = {"vector", "map", "unordered_map", "string"};
+    const char *allocators[] = {"std", "sf", "pmr-new", "pmr-sf"};
+    int failed = 0;
+
+    printf("%-14s %-8s %10s %9s\n", "workload", "alloc", "seconds", "vs std");
+    for (int workload = 0; workload < 4; workload++) {
+        workload_result results[4];
+        results[0] = run_workload(workload, std::allocator<char>(), n, rounds);
+        results[1] = run_workload(workload, sf::allocator<char>(), n, rounds);
+        results[2] = run_workload(workload, std::pmr::polymorphic_allocator<char>(std::pmr::new_delete_resource()), n, rounds);
+        results[3] = run_workload(workload, std::pmr::polymorphic_allocator<char>(sf::resource()), n, rounds);
+
+        for (int alloc = 0; alloc < 4; alloc++) {
+            printf("%-14s %-8s %10.4f %8.2fx\n", workloads[workload], allocators[alloc], results[alloc].seconds,
+                   results[0].seconds / results[alloc].seconds);
+            if (results[alloc].checksum != results[0].checksum) {
+                fprintf(stderr, "error: %s with %s computed a different checksum\n", workloads[workload], allocators[alloc]);
+                failed = 1;
+            }
+        }
+    }
+
+    sf_stats stats;
+    sf_get_stats(&stats);
+    if (stats.live_bytes != 0) {
+        fprintf(stderr, "error: %zu bytes are still allocated from the sf heap\n", stats.live_bytes);
+        failed = 1;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/*
+ * Contention benchmark for the SF_THREADS build of the allocator.
+ *
+ * Runs the same malloc/free loop on 1, 2, 4, ... up to N threads and reports the total
+ * throughput for each thread count, once with the thread caches on and once with them off
+ * (so every call goes through the per-size-class locks).
+ *
+ * usage: bin/sfmm_contention [-t max_threads] [-n ops_per_thread]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+/*
+ * The heap from sf_mem_grow is only ~100KB, so each thread keeps a small working set:
+ * LIVE_BLOCKS slots of up to MAX_REQUEST bytes, replaced at random.
+ */
+#define LIVE_BLOCKS 8
+#define MAX_REQUEST 320
+
+typedef struct worker {
+    pthread_t thread;
+    unsigned seed;
+    long ops;
+    long failures;
+} worker;
+
+static pthread_barrier_t start_barrier;
+
+static unsigned next_random(unsigned *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+static void *run_worker(void *arg) {
+    worker *w = arg;
+    void *live[LIVE_BLOCKS] = {0};
+
+    pthread_barrier_wait(&start_barrier);
+    for (long op = 0; op < w->ops; op++) {
+        int slot = next_random(&w->seed) % LIVE_BLOCKS;
+        if (live[slot] != NULL) {
+            sf_free(live[slot]);
+            live[slot] = NULL;
+        } else {
+            size_t size = 1 + next_random(&w->seed) % MAX_REQUEST;
+            live[slot] = sf_malloc(size);
+            if (live[slot] == NULL) w->failures++;
+            else memset(live[slot], slot, size < 64 ? size : 64);
+        }
+    }
+
+    for (int slot = 0; slot < LIVE_BLOCKS; slot++) {
+        if (live[slot] != NULL) sf_free(live[slot]);
+    }
+    sf_tcache_flush();
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run_round(int threads, long ops) {
+    worker *workers = calloc(threads, sizeof(worker));
+    long failures = 0;
+
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++) {
+        workers[i].seed = 7919 * (i + 1);
+        workers[i].ops = ops;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failures += workers[i].failures;
+    }
+    double elapsed = now_seconds() - start;
+
+    pthread_barrier_destroy(&start_barrier);
+    free(workers);
+    if (failures) fprintf(stderr, "warning: %ld allocations failed with %d threads\n", failures, threads);
+    return (threads * (double)ops) / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long ops = 200000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+        switch (opt) {
+        case 't': max_threads = atoi(optarg); break;
+        case 'n': ops = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-t max_threads] [-n ops_per_thread]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (max_threads < 1) max_threads = 1;
+
+    printf("%-8s %-8s %14s %9s\n", "tcache", "threads", "ops/sec", "speedup");
+    for (int tcache = 1; tcache >= 0; tcache--) {
+        sf_mallopt(SF_OPT_TCACHE, tcache);
+
+        double single = 0;
+        int threads = 1;
+        while (1) {
+            double rate = run_round(threads, ops);
+            if (threads == 1) single = rate;
+            printf("%-8s %-8d %14.0f %8.2fx\n", tcache ? "on" : "off", threads, rate, rate / single);
+
+            if (threads == max_threads) break;
+            threads = (threads * 2 < max_threads) ? threads * 2 : max_threads;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,489 @@
+/*
+ * Trace replay benchmark for the allocator.
+ *
+ * Replays a trace of sf_malloc/sf_realloc/sf_memalign/sf_free calls and reports the throughput,
+ * the latency percentiles of single calls, the peak heap size and the heap utilization (the most
+ * payload bytes live at once divided by the peak heap size).  A trace is either read from a file
+ * or generated by one of the synthetic workloads below, which are seeded so every run replays
+ * exactly the same calls.
+ *
+ * Trace files have one call per line, and '#' starts a comment:
+ *
+ *     m <id> <size>            id = sf_malloc(size)
+ *     r <id> <size>            id = sf_realloc(id, size)
+ *     a <id> <size> <align>    id = sf_memalign(size, align)
+ *     f <id>                   sf_free(id)
+ *
+ * An id (0 to MAX_IDS - 1) names one live allocation.  If a call fails during the replay, the
+ * later calls on its id are skipped.
+ *
+ * sf_mem_grow can't give memory back, so every trace is replayed in a child process that starts
+ * with an empty heap.  Each trace is replayed twice: once timed as a whole for the throughput and
+ * once with every call timed on its own for the percentiles.  Since the heap is new, the child can
+ * also pick the size class scheme (SF_OPT_SIZE_CLASSES) before the first call, so -c compares the
+ * schemes on the same traces: every trace is replayed once per scheme given.
+ *
+ * usage: bin/sfmm_replay [-w workload]... [-f trace]... [-c classes]... [-n ops] [-s seed] [-o file]
+ *
+ *     With no -w or -f every synthetic workload is run, and with no -c the scheme the allocator
+ *     was built with is used.  -c all runs every scheme.  -o writes the trace of the first workload
+ *     or file given to a file instead of replaying it.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sfmm.h"
+#include "sfmm_ext.h"
+
+#define MAX_IDS 65536
+#define MAX_TRACES 32
+#define DEFAULT_CLASSES -1 // don't set SF_OPT_SIZE_CLASSES
+
+typedef struct trace_op {
+    char type;
+    int id;
+    size_t size;
+    size_t align;
+} trace_op;
+
+typedef struct trace {
+    const char *name;
+    trace_op *ops;
+    long count;
+    long capacity;
+} trace;
+
+typedef struct replay_result {
+    long ops;
+    long failures;
+    double seconds;
+    double percentiles[5]; // latency in ns at the points in percentile_points
+    size_t peak_heap;
+    size_t peak_payload;
+} replay_result;
+
+static const double percentile_points[5] = {50, 90, 99, 99.9, 100};
+
+static unsigned next_random(unsigned *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+static void trace_add(trace *t, char type, int id, size_t size, size_t align) {
+    if (t->count == t->capacity) {
+        t->capacity = t->capacity ? 2 * t->capacity : 1024;
+        t->ops = realloc(t->ops, t->capacity * sizeof(trace_op));
+        if (t->ops == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    t->ops[t->count++] = (trace_op){type, id, size, align};
+}
+
+/*
+ * Synthetic workloads.  Each one fills a trace with about ops calls and only uses ids the way a
+ * real program would: no id is allocated twice or used after it was freed.  They are sized for
+ * the ~100KB heap that sf_mem_grow can provide.
+ */
+
+// Random malloc and free of 1-512 bytes over 64 ids: a steady state with a mixed free list
+static void generate_churn(trace *t, long ops, unsigned seed) {
+    char live[64] = {0};
+
+    while (t->count < ops) {
+        int id = next_random(&seed) % 64;
+        if (live[id]) trace_add(t, 'f', id, 0, 0);
+        else trace_add(t, 'm', id, 1 + next_random(&seed) % 512, 0);
+        live[id] = !live[id];
+    }
+}
+
+// Allocates 192 blocks of growing size, then frees them all in random order, over and over
+static void generate_ramp(trace *t, long ops, unsigned seed) {
+    int order[192];
+
+    while (t->count < ops) {
+        for (int id = 0; id < 192; id++) {
+            trace_add(t, 'm', id, 1 + id + next_random(&seed) % 64, 0);
+            order[id] = id;
+        }
+        for (int i = 191; i > 0; i--) {
+            int j = next_random(&seed) % (i + 1);
+            int swap = order[i];
+            order[i] = order[j];
+            order[j] = swap;
+        }
+        for (int i = 0; i < 192; i++) {
+            trace_add(t, 'f', order[i], 0, 0);
+        }
+    }
+}
+
+// A queue of up to 64 messages of 32-1024 bytes, produced and consumed in bursts, freed oldest first
+static void generate_producer_consumer(trace *t, long ops, unsigned seed) {
+    int head = 0;
+    int length = 0;
+
+    while (t->count < ops) {
+        int burst = 1 + next_random(&seed) % 16;
+        for (int i = 0; i < burst && length < 64; i++, length++) {
+            trace_add(t, 'm', (head + length) % 64, 32 + next_random(&seed) % 993, 0);
+        }
+
+        burst = 1 + next_random(&seed) % 16;
+        for (int i = 0; i < burst && length > 0; i++, length--) {
+            trace_add(t, 'f', head, 0, 0);
+            head = (head + 1) % 64;
+        }
+    }
+}
+
+// 32 buffers that mostly grow by realloc, sometimes shrink, and are freed once they pass 2KB
+static void generate_realloc(trace *t, long ops, unsigned seed) {
+    size_t size[32] = {0};
+
+    while (t->count < ops) {
+        int id = next_random(&seed) % 32;
+        unsigned choice = next_random(&seed) % 8;
+
+        if (size[id] == 0) {
+            size[id] = 16 + next_random(&seed) % 49;
+            trace_add(t, 'm', id, size[id], 0);
+        } else if (size[id] > 2048 || choice == 0) {
+            trace_add(t, 'f', id, 0, 0);
+            size[id] = 0;
+        } else if (choice == 1) {
+            size[id] = 1 + size[id] / 2;
+            trace_add(t, 'r', id, size[id], 0);
+        } else {
+            size[id] += size[id] / 2 + next_random(&seed) % 32;
+            trace_add(t, 'r', id, size[id], 0);
+        }
+    }
+}
+
+typedef struct workload {
+    const char *name;
+    const char *description;
+    void (*generate)(trace *t, long ops, unsigned seed);
+} workload;
+
+static const workload workloads[] = {
+    {"churn", "random malloc/free of 1-512 bytes over 64 live ids", generate_churn},
+    {"ramp", "allocate 192 growing blocks, free them in random order", generate_ramp},
+    {"prodcons", "FIFO queue of 32-1024 byte messages, filled and drained in bursts", generate_producer_consumer},
+    {"realloc", "32 buffers grown and shrunk by realloc up to 2KB", generate_realloc},
+};
+#define NUM_WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+typedef struct class_scheme {
+    const char *name;
+    int value;
+} class_scheme;
+
+static const class_scheme class_schemes[] = {
+    {"fib", SF_CLASSES_FIBONACCI},
+    {"pow2", SF_CLASSES_POWER_OF_TWO},
+    {"quarter", SF_CLASSES_QUARTER},
+};
+#define NUM_CLASS_SCHEMES ((int)(sizeof(class_schemes) / sizeof(class_schemes[0])))
+
+static int load_trace(trace *t, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    char *live = calloc(MAX_IDS, 1);
+    char line[256];
+    long line_number = 0;
+    int ok = 1;
+
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char type;
+        int id;
+        size_t size = 0;
+        size_t align = 0;
+        int fields = sscanf(line, " %c %d %zu %zu", &type, &id, &size, &align);
+        if (fields <= 0) continue; // blank line or only a comment
+
+        int expected = (type == 'm' || type == 'r') ? 3 : (type == 'a') ? 4 : (type == 'f') ? 2 : -1;
+        if (fields != expected || id < 0 || id >= MAX_IDS) {
+            fprintf(stderr, "%s:%ld: malformed call\n", path, line_number);
+            ok = 0;
+        } else if ((type == 'm' || type == 'a') == live[id]) {
+            fprintf(stderr, "%s:%ld: id %d is %s\n", path, line_number, id, live[id] ? "already live" : "not live");
+            ok = 0;
+        } else {
+            trace_add(t, type, id, size, align);
+            if (type != 'r') live[id] = !live[id];
+            else if (size == 0) live[id] = 0; // realloc to 0 frees
+        }
+    }
+
+    free(live);
+    fclose(file);
+    return ok;
+}
+
+static int write_trace(const trace *t, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    fprintf(file, "# %s, %ld calls\n", t->name, t->count);
+    for (long i = 0; i < t->count; i++) {
+        const trace_op *op = &t->ops[i];
+        switch (op->type) {
+        case 'm': case 'r': fprintf(file, "%c %d %zu\n", op->type, op->id, op->size); break;
+        case 'a': fprintf(file, "a %d %zu %zu\n", op->id, op->size, op->align); break;
+        case 'f': fprintf(file, "f %d\n", op->id); break;
+        }
+    }
+    return fclose(file) == 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Replays the trace on the heap of the calling process.  With latencies non-NULL every call is
+ * timed on its own and its time stored there; calls that were skipped store nothing.  The first
+ * byte of every block handed out is written so the replay touches the memory like a program would.
+ */
+static void replay(const trace *t, replay_result *result, uint64_t *latencies) {
+    void **live = calloc(MAX_IDS, sizeof(void *));
+    size_t *live_size = calloc(MAX_IDS, sizeof(size_t));
+    size_t payload = 0;
+    uint64_t start = now_ns();
+
+    for (long i = 0; i < t->count; i++) {
+        const trace_op *op = &t->ops[i];
+        void *old = live[op->id];
+        if ((op->type == 'm' || op->type == 'a') ? old != NULL : old == NULL) continue; // an earlier call failed
+
+        uint64_t call_start = latencies ? now_ns() : 0;
+        void *block = NULL;
+        switch (op->type) {
+        case 'm': block = sf_malloc(op->size); break;
+        case 'a': block = sf_memalign(op->size, op->align); break;
+        case 'r': block = sf_realloc(old, op->size); break;
+        case 'f': sf_free(old); break;
+        }
+        if (latencies) latencies[result->ops] = now_ns() - call_start;
+        result->ops++;
+
+        if (op->type == 'f' || (op->type == 'r' && op->size == 0)) {
+            payload -= live_size[op->id];
+            live[op->id] = NULL;
+            continue;
+        }
+        if (block == NULL) {
+            result->failures++;
+            continue;
+        }
+
+        *(char *)block = (char)i;
+        payload += op->size - (op->type == 'r' ? live_size[op->id] : 0);
+        live[op->id] = block;
+        live_size[op->id] = op->size;
+        if (payload > result->peak_payload) result->peak_payload = payload;
+    }
+    result->seconds = (now_ns() - start) / 1e9;
+
+    sf_stats stats;
+    sf_get_stats(&stats);
+    result->peak_heap = stats.peak_heap_size;
+
+    free(live);
+    free(live_size);
+}
+
+/*
+ * Runs replay in a child process so the trace starts on an empty heap with the size class scheme
+ * classes (or the default one), and passes the result back through a pipe.  Returns 0 if the child
+ * didn't finish, e.g. because the allocator aborted.
+ */
+static int replay_in_child(const trace *t, int classes, replay_result *result, int timed_calls) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return 0;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        replay_result child_result = {0};
+        if (classes != DEFAULT_CLASSES && !sf_mallopt(SF_OPT_SIZE_CLASSES, classes)) _exit(EXIT_FAILURE);
+        uint64_t *latencies = timed_calls ? malloc(t->count * sizeof(uint64_t)) : NULL;
+
+        replay(t, &child_result, latencies);
+        if (latencies != NULL) {
+            qsort(latencies, child_result.ops, sizeof(uint64_t), compare_u64);
+            for (int p = 0; p < 5; p++) {
+                long rank = (long)(percentile_points[p] / 100 * child_result.ops + 0.5);
+                if (rank > 0) rank--;
+                child_result.percentiles[p] = child_result.ops ? (double)latencies[rank] : 0;
+            }
+        }
+
+        ssize_t written = write(fds[1], &child_result, sizeof(child_result));
+        _exit(written == sizeof(child_result) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(fds[1]);
+
+    ssize_t got = pid > 0 ? read(fds[0], result, sizeof(*result)) : -1;
+    close(fds[0]);
+
+    int status = 0;
+    if (pid > 0) waitpid(pid, &status, 0);
+    if (got != sizeof(*result)) {
+        if (pid > 0 && WIFSIGNALED(status)) fprintf(stderr, "%s: replay killed by signal %d\n", t->name, WTERMSIG(status));
+        else fprintf(stderr, "%s: replay failed\n", t->name);
+        return 0;
+    }
+    return 1;
+}
+
+static void run_trace(const trace *t, const class_scheme *scheme) {
+    replay_result throughput = {0};
+    replay_result latency = {0};
+    int classes = scheme ? scheme->value : DEFAULT_CLASSES;
+
+    if (!replay_in_child(t, classes, &throughput, 0) || !replay_in_child(t, classes, &latency, 1)) return;
+
+    double utilization = throughput.peak_heap ? 100.0 * throughput.peak_payload / throughput.peak_heap : 0;
+    printf("%-12s %-8s %9ld %7ld %12.0f", t->name, scheme ? scheme->name : "-", throughput.ops, throughput.failures, throughput.ops / throughput.seconds);
+    for (int p = 0; p < 5; p++) {
+        printf(" %7.0f", latency.percentiles[p]);
+    }
+    printf(" %10zu %6.1f%%\n", throughput.peak_heap, utilization);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-w workload]... [-f trace]... [-c classes]... [-n ops] [-s seed] [-o file]\n\nworkloads:\n", program);
+    for (int w = 0; w < NUM_WORKLOADS; w++) {
+        fprintf(stderr, "  %-10s %s\n", workloads[w].name, workloads[w].description);
+    }
+    fprintf(stderr, "\nclasses: all");
+    for (int c = 0; c < NUM_CLASS_SCHEMES; c++) {
+        fprintf(stderr, " %s", class_schemes[c].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *names[MAX_TRACES];
+    int is_file[MAX_TRACES];
+    int num_traces = 0;
+    const class_scheme *schemes[NUM_CLASS_SCHEMES];
+    int num_schemes = 0;
+    long ops = 100000;
+    unsigned seed = 1;
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:f:c:n:s:o:")) != -1) {
+        switch (opt) {
+        case 'w':
+        case 'f':
+            if (num_traces == MAX_TRACES) {
+                fprintf(stderr, "at most %d traces\n", MAX_TRACES);
+                return EXIT_FAILURE;
+            }
+            names[num_traces] = optarg;
+            is_file[num_traces++] = (opt == 'f');
+            break;
+        case 'c': {
+            int found = 0;
+            for (int c = 0; c < NUM_CLASS_SCHEMES; c++) {
+                if (strcmp(optarg, "all") != 0 && strcmp(optarg, class_schemes[c].name) != 0) continue;
+                found = 1;
+                int listed = 0;
+                for (int i = 0; i < num_schemes; i++) listed |= (schemes[i] == &class_schemes[c]);
+                if (!listed) schemes[num_schemes++] = &class_schemes[c];
+            }
+            if (!found) {
+                fprintf(stderr, "unknown classes: %s\n", optarg);
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        case 'n': ops = atol(optarg); break;
+        case 's': seed = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'o': output = optarg; break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (num_traces == 0) {
+        for (int w = 0; w < NUM_WORKLOADS; w++) {
+            names[num_traces] = workloads[w].name;
+            is_file[num_traces++] = 0;
+        }
+    }
+
+    if (output == NULL) {
+        printf("%-12s %-8s %9s %7s %12s %7s %7s %7s %7s %7s %10s %7s\n", "trace", "classes", "calls", "failed", "calls/sec",
+               "p50 ns", "p90", "p99", "p99.9", "max", "peak heap", "util");
+    }
+
+    for (int i = 0; i < num_traces; i++) {
+        trace t = {names[i], NULL, 0, 0};
+
+        if (is_file[i]) {
+            if (!load_trace(&t, names[i])) return EXIT_FAILURE;
+        } else {
+            int w = 0;
+            while (w < NUM_WORKLOADS && strcmp(workloads[w].name, names[i]) != 0) w++;
+            if (w == NUM_WORKLOADS) {
+                fprintf(stderr, "unknown workload: %s\n", names[i]);
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            workloads[w].generate(&t, ops, seed);
+        }
+
+        if (output != NULL) {
+            int written = write_trace(&t, output);
+            free(t.ops);
+            return written ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (num_schemes == 0) run_trace(&t, NULL);
+        for (int c = 0; c < num_schemes; c++) {
+            run_trace(&t, schemes[c]);
+        }
+        free(t.ops);
+    }
+
+    return EXIT_SUCCESS;
+}
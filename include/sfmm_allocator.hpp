@@ -0,0 +1,132 @@
+#ifndef SFMM_ALLOCATOR_HPP
+#define SFMM_ALLOCATOR_HPP
+
+/*
+ * C++ adapters for the sf_* allocator, so standard containers can allocate from it:
+ *
+ *     std::vector<int, sf::allocator<int>> v;                  // any C++11 container
+ *     std::pmr::vector<int> w(sf::resource());                 // C++17 polymorphic allocators
+ *
+ * sf::allocator is a stateless allocator (every instance is equal to every other), and
+ * sf::memory_resource is a std::pmr::memory_resource; sf::resource() returns the one instance a
+ * program needs.  Both allocate with sf_malloc, or with sf_memalign for types aligned to more than
+ * the 32 bytes every sf_malloc payload has, and throw std::bad_alloc when the allocator is out of
+ * memory.  The size the container gives back on deallocation is passed on to sf_free_sized, so
+ * the free doesn't have to decode the block header.
+ *
+ * sfmm.h has no extern "C" block, so C++ code includes this header (or sfmm_ext.h) instead, and
+ * the three functions it needs from sfmm.h are declared here.
+ */
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+
+#include "sfmm_ext.h"
+
+extern "C" {
+void *sf_malloc(size_t size);
+void sf_free(void *ptr);
+void *sf_memalign(size_t size, size_t align);
+}
+
+namespace sf {
+
+/*
+ * Alignment of every payload sf_malloc returns.
+ */
+constexpr std::size_t malloc_alignment = 32;
+
+/*
+ * Allocates bytes bytes aligned to align, a power of two.  A request for 0 bytes gets 1 byte, as
+ * operator new does, since sf_malloc returns NULL for 0.
+ *
+ * @throw std::bad_alloc If there is no memory.
+ */
+inline void *allocate_bytes(std::size_t bytes, std::size_t align) {
+    if (bytes == 0) bytes = 1;
+    void *ptr = (align <= malloc_alignment) ? sf_malloc(bytes) : sf_memalign(bytes, align);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+/*
+ * Frees memory from allocate_bytes, given the same bytes it was allocated with.  The alignment is
+ * accepted for symmetry: sf_free_sized finds aligned blocks without it.
+ */
+inline void deallocate_bytes(void *ptr, std::size_t bytes, std::size_t align) noexcept {
+    (void)align;
+    sf_free_sized(ptr, (bytes != 0) ? bytes : 1);
+}
+
+/*
+ * A stateless allocator for standard containers.
+ */
+template <class T>
+class allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    allocator() noexcept = default;
+
+    template <class U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+        return static_cast<T *>(allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        deallocate_bytes(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+#if __cplusplus >= 201703L
+/*
+ * A memory resource for std::pmr containers.  All instances share the one heap, so any of them
+ * can free what another allocated.
+ */
+class memory_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t align) override {
+        return allocate_bytes(bytes, align);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t align) override {
+        deallocate_bytes(ptr, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other || dynamic_cast<const memory_resource *>(&other) != nullptr;
+    }
+};
+
+/*
+ * Returns the program's sf::memory_resource, like std::pmr::new_delete_resource().
+ */
+inline memory_resource *resource() noexcept {
+    static memory_resource instance;
+    return &instance;
+}
+#endif
+
+} // namespace sf
+
+#endif
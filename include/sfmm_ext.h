@@ -0,0 +1,369 @@
+#ifndef SFMM_EXT_H
+#define SFMM_EXT_H
+
+/*
+ * Extensions to the sf_* allocator interface declared in sfmm.h.
+ *
+ * sfmm.h is not allowed to change, so anything a client needs on top of
+ * sf_malloc/sf_realloc/sf_free/sf_memalign is declared here.  This header
+ * only depends on the standard headers so it can also be included from code
+ * that can't include sfmm.h directly.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Options understood by sf_mallopt().
+ *
+ * SF_OPT_TCACHE          Turn the per-thread cache of small freed blocks on (1) or off (0).
+ *                        Turning it off flushes the calling thread's cache back to the heap.
+ *                        Default: 0.
+ * SF_OPT_TCACHE_COUNT    Number of blocks a single cache bin may hold before half of it is
+ *                        flushed back to the shared free lists.
+ * SF_OPT_SLAB            Serve requests of up to 96 bytes from slabs (1) instead of the free lists (0).
+ *                        Slab objects have no header and are never coalesced.  Objects allocated
+ *                        while slabs were on can still be freed after turning them off.  Default: 0.
+ * SF_OPT_GROW_MAX_PAGES  Largest number of pages one heap growth adds on its own (1 to 64).
+ *                        Consecutive growths double from one page up to this; 1 makes the heap
+ *                        grow by exactly what each request needs.  Default: 8.
+ * SF_OPT_FREE_CHECK      Validate the pointer passed to sf_free and sf_free_sized on every n-th free
+ *                        of each thread (n), or never (0).  A free that isn't checked trusts the
+ *                        pointer, and the size given to sf_free_sized, so an invalid or double free
+ *                        corrupts the heap instead of calling abort().  Default: 1, or 64 in builds
+ *                        with SF_FAST_FREE (make fast).
+ * SF_OPT_DEFER_COALESCE  Defer coalescing of freed blocks of up to 512 bytes (value > 0) or not (0).
+ *                        Such blocks wait, still unmerged, on a list for their exact size and are
+ *                        handed out again to requests of that size.  They are all coalesced when a
+ *                        search of the free lists misses and when they add up to more than value
+ *                        bytes.  Turning the mode off coalesces them right away.  Default: 0.
+ * SF_OPT_SIZE_CLASSES    How free blocks are split into size classes, one free list each (one of the
+ *                        SF_CLASSES_* constants below).  Can only be set before the first allocation;
+ *                        once the heap exists, 0 is returned and sf_errno is set to EINVAL.
+ *                        Default: SF_CLASSES_FIBONACCI, or SF_DEFAULT_SIZE_CLASSES if the allocator
+ *                        is built with it defined.  sf_show_heap only knows the Fibonacci lists, so
+ *                        with the other schemes it shows no free blocks; sf_get_stats sees them all.
+ * SF_OPT_MMAP_THRESHOLD  Smallest block, in bytes, that gets a mapping of its own outside the heap
+ *                        (at least 4096), or 0 to keep every block in the heap.  A mapped block is
+ *                        unmapped as soon as it is freed, and sf_realloc resizes it with mremap.
+ *                        Blocks allocated while regions are held always come from the heap.
+ *                        Default: 131072 (128KB).
+ * SF_OPT_TRIM_THRESHOLD  Trim the heap (see sf_trim) whenever a free leaves more than this many
+ *                        resident bytes in the free block at the end of the heap (at least 4096),
+ *                        or never trim on its own (0).  Default: 0.
+ * SF_OPT_REALLOC_SLACK   Bytes a shrinking sf_realloc may leave unused at the end of a block rather
+ *                        than split them off.  A buffer that keeps shrinking and growing again within
+ *                        that much stays where it is, without being split and merged every time.
+ *                        While it is nonzero, sf_free_sized takes a size up to this much smaller than
+ *                        the block.  Default: 0 (anything of 32 bytes or more is split off).
+ * SF_OPT_PROFILE_RATE    Sample about one allocation (of sf_malloc, sf_realloc and sf_memalign) per
+ *                        this many bytes allocated, recording its call stack until it is freed (see
+ *                        sf_profile_dump), or sample nothing (0).  The samples are Poisson
+ *                        distributed over the bytes allocated.  A sampled allocation never comes
+ *                        from a slab.  Default: 0.
+ */
+#define SF_OPT_TCACHE          1
+#define SF_OPT_TCACHE_COUNT    2
+#define SF_OPT_GROW_MAX_PAGES  3
+#define SF_OPT_SLAB            4
+#define SF_OPT_FREE_CHECK      5
+#define SF_OPT_DEFER_COALESCE  6
+#define SF_OPT_SIZE_CLASSES    7
+#define SF_OPT_MMAP_THRESHOLD  8
+#define SF_OPT_TRIM_THRESHOLD  9
+#define SF_OPT_REALLOC_SLACK   10
+#define SF_OPT_PROFILE_RATE    11
+
+/*
+ * Size class schemes for SF_OPT_SIZE_CLASSES.  Class bounds are multiples of the 32 byte minimum
+ * block size, and the last class holds every block bigger than the bound of the one before it.
+ *
+ * SF_CLASSES_FIBONACCI     9 classes bounded by Fibonacci multiples of 32 bytes (32, 64, 96, 160,
+ *                          ... 1088), so everything over 1088 bytes shares the last list.
+ * SF_CLASSES_POWER_OF_TWO  17 classes, one per power of two from 32 bytes up to 1MB.
+ * SF_CLASSES_QUARTER       57 classes: 32, 64, 96 and 128 bytes, then 4 evenly spaced classes per
+ *                          power of two up to 1MB (160, 192, 224, 256, 320, 384, ...), as in jemalloc.
+ */
+#define SF_CLASSES_FIBONACCI    0
+#define SF_CLASSES_POWER_OF_TWO 1
+#define SF_CLASSES_QUARTER      2
+
+/*
+ * Adjusts a tunable of the allocator.
+ *
+ * @param option One of the SF_OPT_* constants above.
+ * @param value The new value for the option.
+ *
+ * @return 1 on success.  If the option is unknown or the value is out of range,
+ * 0 is returned and sf_errno is set to EINVAL.
+ */
+int sf_mallopt(int option, size_t value);
+
+/*
+ * Allocates zeroed memory for count objects of size bytes each.  Memory the heap has just taken
+ * from the page provider is zero already, so only the bytes that may have been written to before
+ * are cleared, and a block that gets a mapping of its own is not cleared at all.
+ *
+ * @param count The number of objects.
+ * @param size The size of each object.
+ *
+ * @return If count or size is 0, NULL is returned without setting sf_errno.  Otherwise a pointer
+ * to count * size zero bytes, or NULL with sf_errno set to ENOMEM if count * size overflows or
+ * there is no memory.
+ */
+void *sf_calloc(size_t count, size_t size);
+
+/*
+ * Frees ptr like sf_free, for callers that know the size they asked for, as with C++14 sized
+ * deallocation.  The size lets the free skip decoding the block header, and the slab lookup for
+ * sizes no slab object holds.
+ *
+ * @param ptr Address of memory returned by sf_malloc, sf_realloc or sf_memalign.
+ * @param size The size passed when ptr was allocated (or last reallocated).
+ *
+ * If ptr is invalid, or size doesn't match its block, the function calls abort() when the free is
+ * checked (see SF_OPT_FREE_CHECK).
+ */
+void sf_free_sized(void *ptr, size_t size);
+
+/*
+ * Returns the number of bytes that can be used at ptr, which is at least the size it was
+ * allocated with and may be more, since requests are rounded up to whole blocks or slab objects.
+ *
+ * @param ptr Address of memory returned by sf_malloc, sf_realloc or sf_memalign, or NULL.
+ *
+ * @return The usable size, or 0 for NULL.  ptr is not validated.
+ */
+size_t sf_usable_size(void *ptr);
+
+/*
+ * Gives the memory of the free block at the end of the heap back to the system, except for its
+ * first keep_bytes bytes.  The end of the heap does not move: the block stays free with the same
+ * size, but its pages are released and come back, zero filled, when an allocation uses them again.
+ * Nothing is trimmed while a region is held, nor when the heap is on the SF_PAGES_STATIC or
+ * SF_PAGES_FILE provider.
+ *
+ * @param keep_bytes Bytes at the start of the free block to leave resident.
+ *
+ * @return 1 if any memory was given back, 0 if there was not a whole page to give back.
+ */
+int sf_trim(size_t keep_bytes);
+
+/*
+ * Writes the heap profile gathered while SF_OPT_PROFILE_RATE was set: per call stack, the sampled
+ * allocations still live and all those made since profiling started, in bytes and counts.  The
+ * format is the heap profile of gperftools, which pprof reads and scales by the sampling rate, e.g.
+ * pprof --text ./program profile.heap.  Nothing is allocated while writing.
+ *
+ * @param fd File descriptor to write the profile to.
+ *
+ * @return 1 on success.  If profiling was never turned on, 0 is returned and sf_errno is set to
+ * EINVAL; if writing fails, 0 is returned and sf_errno is set to the error from write.
+ */
+int sf_profile_dump(int fd);
+
+/*
+ * Page providers for sf_set_page_provider(): where the heap gets its memory from.
+ *
+ * SF_PAGES_SFUTIL  sf_mem_grow() from lib/sfutil.o, PAGE_SZ bytes at a time up to the library's
+ *                  own limit.  The only provider sf_show_heap() and the other sfutil debugging
+ *                  functions know about.  The default.
+ * SF_PAGES_SBRK    The program break.  The heap can't grow once anything else moves the break.
+ * SF_PAGES_MMAP    Anonymous memory.  capacity bytes of address space are reserved up front and
+ *                  memory is only committed as the heap grows into it.
+ * SF_PAGES_STATIC  The capacity bytes at buffer, supplied by the caller.
+ * SF_PAGES_FILE    The file at path, created or truncated, mapped shared and extended as the heap
+ *                  grows (for example a file on a tmpfs or hugetlbfs mount).
+ */
+#define SF_PAGES_SFUTIL 0
+#define SF_PAGES_SBRK   1
+#define SF_PAGES_MMAP   2
+#define SF_PAGES_STATIC 3
+#define SF_PAGES_FILE   4
+
+typedef struct sf_page_config {
+    int provider;                /* one of the SF_PAGES_* constants */
+    size_t page_size;            /* bytes the heap grows by at a time: a power of two from 4096 to
+                                    2097152 (4KB, 64KB, 2MB...), or 0 for 4096 (PAGE_SZ for sfutil) */
+    size_t capacity;             /* most bytes the heap may grow to, or 0 for 256MB (not for static) */
+    void *buffer;                /* SF_PAGES_STATIC only */
+    const char *path;            /* SF_PAGES_FILE only */
+} sf_page_config;
+
+/*
+ * Selects the page provider the heap is built on.  It has to be called before the first
+ * allocation: the provider can't change once the heap has its first page.
+ *
+ * @param config The provider and its page size and capacity.
+ *
+ * @return 1 on success.  If config is NULL or invalid, or the heap already exists, 0 is returned
+ * and sf_errno is set to EINVAL.  If the file of SF_PAGES_FILE can't be opened, 0 is returned and
+ * sf_errno is set to the error from open.
+ */
+int sf_set_page_provider(const sf_page_config *config);
+
+/*
+ * Snapshot of the allocator's counters and gauges, filled in by sf_get_stats().
+ *
+ * Counters only ever grow; take two snapshots and subtract to measure an interval.  Calls are
+ * counted per public entry point, so the sf_malloc and sf_free a moving sf_realloc does inside
+ * don't show up as calls of their own.
+ *
+ * Internal fragmentation is 1 - bytes_requested / bytes_allocated: the share of the block (or slab
+ * object) bytes handed out that the caller never asked for.  External fragmentation is
+ * 1 - largest_free_block / free_bytes: how much of the free memory can't serve one large request.
+ */
+#define SF_STATS_MAX_CLASSES 64
+
+typedef struct sf_stats {
+    /* Calls per entry point */
+    size_t malloc_calls;
+    size_t free_calls;
+    size_t realloc_calls;
+    size_t memalign_calls;
+    size_t calloc_calls;
+    size_t failed_allocations;   /* sf_malloc, sf_realloc, sf_memalign and sf_calloc calls that hit ENOMEM */
+
+    /* Summed over every successful allocation, including a realloc that keeps its block */
+    size_t bytes_requested;      /* sizes the callers asked for */
+    size_t bytes_allocated;      /* block or slab object sizes handed out for them */
+
+    /* Gauges */
+    size_t live_bytes;           /* block and slab object bytes currently handed out */
+    size_t heap_size;            /* bytes the page provider has added to the heap */
+    size_t peak_heap_size;
+    size_t free_bytes;           /* bytes in blocks on the free lists */
+    size_t free_blocks;
+    size_t largest_free_block;
+    size_t free_list_count;      /* entries of free_bytes_per_class that are used */
+    size_t free_bytes_per_class[SF_STATS_MAX_CLASSES];
+    size_t mapped_bytes;         /* bytes mapped for blocks outside the heap (see SF_OPT_MMAP_THRESHOLD) */
+    size_t mapped_blocks;
+
+    /* Heap activity */
+    size_t heap_grows;           /* times the heap was extended, including its first page */
+    size_t coalesces;            /* free blocks merged with a free neighbor */
+    size_t splits;               /* blocks cut in two with the remainder freed */
+    size_t trimmed_bytes;        /* bytes of heap pages given back to the system by trims */
+} sf_stats;
+
+/*
+ * Fills in stats with the current counters and walks the free lists for the free memory gauges.
+ * The counters are spread over a few slots that different threads write to and are added up
+ * here, so in SF_THREADS builds a snapshot taken while other threads allocate is approximate.
+ *
+ * @param stats Where to write the snapshot.
+ *
+ * @return 1 on success.  If stats is NULL, 0 is returned and sf_errno is set to EINVAL.
+ */
+int sf_get_stats(sf_stats *stats);
+
+/*
+ * Arenas are heaps of their own: an arena has its own free lists and its own memory, taken from
+ * the default heap in large chunks, so allocations from different arenas never share a free list,
+ * a lock or a neighbor.  Destroying an arena gives all of its memory back at once.
+ *
+ * The sf_arena_* functions behave like sf_malloc, sf_free, sf_realloc and sf_memalign, except that
+ * a pointer must always be passed back to the arena it came from.  A NULL arena names the default
+ * heap, so sf_arena_malloc(NULL, size) is sf_malloc(size).  Arena calls are not counted in the
+ * call and byte counters of sf_get_stats; instead the arena and its chunks count as live bytes of the
+ * default heap while the arena exists.
+ *
+ * In SF_THREADS builds each arena has one lock, so an arena is best used by one thread or one
+ * subsystem at a time.
+ */
+typedef struct sf_arena sf_arena;
+
+/*
+ * Creates an empty arena.  Its first chunk is taken from the default heap on its first allocation.
+ *
+ * @return The new arena, or NULL with sf_errno set to ENOMEM.
+ */
+sf_arena *sf_arena_create(void);
+
+/*
+ * Gives every chunk of the arena back to the default heap.  All pointers allocated from the arena
+ * become invalid, and the arena must not be in use by another thread.  Does nothing for NULL.
+ */
+void sf_arena_destroy(sf_arena *arena);
+
+void *sf_arena_malloc(sf_arena *arena, size_t size);
+void sf_arena_free(sf_arena *arena, void *ptr);
+void *sf_arena_realloc(sf_arena *arena, void *ptr, size_t size);
+void *sf_arena_memalign(sf_arena *arena, size_t size, size_t align);
+
+/*
+ * Allocates n blocks of size bytes each, all cut from one free block when the heap has one big
+ * enough, so the free lists are searched once rather than n times.  Each block is freed on its own,
+ * with sf_free or sf_free_batch.  sf_get_stats counts the batch as n calls of sf_malloc.
+ *
+ * @param size The number of bytes requested for each block.
+ * @param n The number of blocks.
+ * @param out Where the n pointers are written.
+ *
+ * @return The number of pointers written to out.  If it is less than n (and n and size are
+ * nonzero), sf_errno is set to ENOMEM, or to EINVAL if out is NULL.
+ */
+size_t sf_malloc_batch(size_t size, size_t n, void **out);
+
+/*
+ * Frees the n pointers in ptrs, as n calls to sf_free would.  The pointers are sorted by address
+ * in place first, so that blocks next to each other in the heap are coalesced and put on a free
+ * list once for the whole run.  sf_get_stats counts the batch as n calls of sf_free.
+ *
+ * If any pointer is invalid, or appears twice, the function calls abort().
+ */
+void sf_free_batch(void **ptrs, size_t n);
+
+/*
+ * Regions are for allocations that all die together, like the objects built while handling one
+ * request: take a mark, allocate, and release the mark to give back everything allocated since,
+ * in constant time, without calling sf_free on each pointer.
+ *
+ * While a mark is held every sf_malloc, sf_realloc and sf_memalign is served from the end of the
+ * heap by moving a pointer forward; sf_free on such a pointer does nothing (a double free is not
+ * caught) and its memory stays in use until the mark is released.  Marks nest: releasing one
+ * releases every mark taken after it.  Memory allocated before the first mark is not affected and
+ * can be freed as usual.  Slabs, arenas and the thread cache don't grow the heap while a mark is
+ * held, and report ENOMEM once the free memory below the mark runs out.
+ *
+ * In SF_THREADS builds a region covers the whole heap: the allocations of every thread come from it
+ * until it is released.
+ */
+typedef struct sf_region_mark {
+    void *position;      /* the rest is filled in by sf_region_begin and only read back */
+    size_t depth;
+    size_t allocated;
+} sf_region_mark;
+
+/*
+ * Takes a mark at the current end of the heap.
+ *
+ * @return 1 on success.  If mark is NULL, 0 is returned and sf_errno is set to EINVAL; if the heap
+ * can't be set up, 0 is returned and sf_errno is set to ENOMEM.
+ */
+int sf_region_begin(sf_region_mark *mark);
+
+/*
+ * Gives back every block allocated since the mark was taken.  All pointers to those blocks become
+ * invalid.  Releasing the first mark taken also ends region mode.
+ *
+ * @return 1 on success.  If mark is NULL, was already released or doesn't belong to the region
+ * that is held, 0 is returned and sf_errno is set to EINVAL.
+ */
+int sf_region_release(const sf_region_mark *mark);
+
+/*
+ * Returns every block held in the calling thread's cache to the shared free lists.
+ * Threads that exit have their cache flushed automatically in SF_THREADS builds.
+ */
+void sf_tcache_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 #define test_header_h
 
 #include "sfmm.h"
+#include "sfmm_ext.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,6 +15,202 @@
 #define PREV_BLOCK_ALLOC 0x8
 #define EPILOGUE_SIZE 8
 #define PROLOGUE_SIZE 32
+#define CACHED_BLOCK 0x4 // block is allocated but parked in a thread cache
+#define MMAPPED_BLOCK 0x2 // block has a mapping of its own, outside the heap
+#define SAMPLED_BLOCK 0x1 // block was sampled by the heap profiler, which has to see it freed
+
+// Thread cache: one bin per block size from MIN_BLOCK_SIZE up to the end of free list 3 (5M)
+#define TCACHE_MAX_SIZE (5 * MIN_BLOCK_SIZE)
+#define TCACHE_NUM_BINS (TCACHE_MAX_SIZE / MIN_BLOCK_SIZE)
+#define TCACHE_DEFAULT_COUNT 16
+#define TCACHE_MAX_COUNT 1024
+#define TCACHE_REFILL_BATCH 8
+
+#define TAG_LOCK_STRIPES 256 // must be a power of two
+
+// Heap growth: each growth doubles the minimum pages added by the next one, up to the max
+#define GROW_DEFAULT_MAX_PAGES 8
+#define GROW_MAX_PAGES_LIMIT 64
+
+// Slab layer: requests up to SLAB_MAX_SIZE bytes come from one-page slabs of 32, 64 or 96 byte objects
+#define SLAB_OBJECT_UNIT 32
+#define SLAB_NUM_CLASSES 3
+#define SLAB_MAX_SIZE (SLAB_NUM_CLASSES * SLAB_OBJECT_UNIT)
+#define SLAB_BLOCK_SIZE PAGE_SZ
+#define SLAB_MAX_OBJECTS 64 // one bit per object in free_objects
+#define SLAB_PAGE_MAP_PAGES 1024 // slabs are only made in the first 1024 pages (2 MB) of the heap, past that small requests get blocks
+
+// Deferred coalescing: one quick list per block size from MIN_BLOCK_SIZE up to QUICK_MAX_SIZE
+#define QUICK_MAX_SIZE 512
+#define QUICK_NUM_LISTS (QUICK_MAX_SIZE / MIN_BLOCK_SIZE)
+
+// Mapped blocks: blocks of at least sf_mmap_threshold bytes get their own mapping (see SF_OPT_MMAP_THRESHOLD)
+#define MMAP_DEFAULT_THRESHOLD (128 * 1024)
+#define MMAP_MIN_THRESHOLD 4096
+#define MMAP_CHECK_MAGIC 0x6d6d61705f736621ULL
+
+// Page providers other than sfutil grow the heap by pages of PAGES_MIN_SIZE to PAGES_MAX_SIZE bytes
+#define PAGES_MIN_SIZE 4096
+#define PAGES_MAX_SIZE (2 * 1024 * 1024)
+#define PAGES_DEFAULT_SIZE 4096
+#define PAGES_DEFAULT_CAPACITY ((size_t)256 * 1024 * 1024)
+
+// Heap profiler: stacks of up to PROFILE_MAX_DEPTH frames, above the PROFILE_SKIP_FRAMES of the allocator
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_SKIP_FRAMES 2
+#define PROFILE_MAX_STACKS 4096 // must be a power of two
+#define PROFILE_MAX_SAMPLES 65536 // must be a power of two
+
+// sf_calloc: the header, list links and tree links a free block keeps at its start
+#define FREE_BLOCK_FRONT (sizeof(sf_header) + 4 * sizeof(sf_block *))
+
+// Heap trimming: automatic trims keep at least TRIM_MIN_THRESHOLD resident bytes in the wilderness
+#define TRIM_MIN_THRESHOLD 4096
+
+// Free validation: check_pointer runs on every FREE_CHECK_DEFAULT_INTERVAL-th free (see SF_OPT_FREE_CHECK)
+#ifdef SF_FAST_FREE
+#define FREE_CHECK_DEFAULT_INTERVAL 64
+#else
+#define FREE_CHECK_DEFAULT_INTERVAL 1
+#endif
+
+// Statistics: threads spread their counter updates over STAT_SLOTS cache-line sized slots
+#define STAT_SLOTS 16 // must be a power of two
+
+// Arenas: each chunk is a default heap block laid out as [chunk block header, sf_arena_chunk, padding]
+// [arena blocks] [epilogue, unused], so the first arena block header sits 8 bytes below a 32 byte boundary
+#define ARENA_CHUNK_FRONT 64
+#define ARENA_CHUNK_BACK 32
+#define ARENA_CHUNK_OVERHEAD (ARENA_CHUNK_FRONT + ARENA_CHUNK_BACK)
+#define ARENA_MIN_CHUNK_SIZE (2 * PAGE_SZ)
+
+#define SIZE_CLASS_TABLE_UNITS 255 // largest size, in MIN_BLOCK_SIZE units, the size class table covers
+
+// Size classes: SF_OPT_SIZE_CLASSES picks the scheme, which sets how many of the lists are used
+#define MAX_FREE_LISTS 64 // one bit each in a uint64_t bitmap
+#define SIZE_CLASS_MAX_UNITS 32768 // bound of the largest class before the last one (1MB), in MIN_BLOCK_SIZE units
+#define LAST_FREE_LIST (sf_num_free_lists - 1)
+#ifndef SF_DEFAULT_SIZE_CLASSES
+#define SF_DEFAULT_SIZE_CLASSES SF_CLASSES_FIBONACCI
+#endif
+
+#define NO_ALIGNED_FIT ((size_t)-1) // aligned_block_offset: no aligned block fits in the free block
+
+#define FREE_LIST_BIT(index) ((uint64_t)1 << (index)) // bit of free list index in sf_free_list_bitmap
+
+#ifdef SF_THREADS
+#include <pthread.h>
+extern pthread_mutex_t sf_free_list_locks[MAX_FREE_LISTS];
+extern pthread_mutex_t sf_grow_lock;
+#define SF_LOCK(lock) pthread_mutex_lock(&(lock))
+#define SF_UNLOCK(lock) pthread_mutex_unlock(&(lock))
+#define SF_THREAD_LOCAL __thread
+#else
+#define SF_LOCK(lock)
+#define SF_UNLOCK(lock)
+#define SF_THREAD_LOCAL
+#endif
+
+/*
+    Descriptor at the start of a slab's payload; the objects follow it.  Its size is a multiple of 32
+    so every object stays 32 byte aligned.
+*/
+typedef struct sf_slab {
+    struct sf_slab *next; // slabs of the same class with free objects
+    struct sf_slab *prev;
+    uint64_t free_objects; // bit i is set while object i is free
+    unsigned int class_index;
+    unsigned int object_count;
+} sf_slab;
+
+/*
+    Counters behind sf_get_stats.  Each thread adds to one slot, so the slots are padded to a cache
+    line to keep threads on different slots from sharing one.  live_bytes goes up in one slot and
+    down in another when a block is freed by a different thread than the one that allocated it;
+    it wraps around in the slots but their sum is right.
+*/
+typedef struct sf_stat_counters {
+    size_t malloc_calls;
+    size_t free_calls;
+    size_t realloc_calls;
+    size_t memalign_calls;
+    size_t calloc_calls;
+    size_t failed_allocations;
+    size_t bytes_requested;
+    size_t bytes_allocated;
+    size_t live_bytes;
+    size_t coalesces;
+    size_t splits;
+    size_t mapped_bytes;
+    size_t mapped_blocks;
+    size_t trimmed_bytes;
+} __attribute__((aligned(64))) sf_stat_counters;
+
+#ifdef SF_THREADS
+#define SF_STAT_ADD(field, n) __atomic_fetch_add(&stat_slot()->field, (size_t)(n), __ATOMIC_RELAXED)
+#else
+#define SF_STAT_ADD(field, n) (stat_slot()->field += (size_t)(n))
+#endif
+#define SF_STAT_SUB(field, n) SF_STAT_ADD(field, -(size_t)(n))
+
+/*
+    One set of segregated free lists: the sentinels, the bitmap of non-empty lists and the tree indexing the
+    last list.  The default heap's set is sf_default_lists (sf_free_list_heads, sf_free_list_bitmap and
+    sf_large_block_root); every arena has its own.  Only the first sf_num_free_lists sentinels are used, and
+    schemes with more than NUM_FREE_LISTS classes put the default heap's in sf_extended_free_list_heads.
+*/
+typedef struct sf_list_set {
+    sf_block *heads; // sf_num_free_lists sentinels
+    uint64_t *bitmap; // bit i is set while list i is not empty
+    sf_block **large_root; // tree of the blocks on the last list, by (size, address)
+} sf_list_set;
+
+/*
+    Descriptor right in front of the header of a mapped block, recording its mapping.
+*/
+typedef struct sf_mmap_chunk {
+    char *map_start;
+    size_t map_size;
+    uintptr_t check; // the block address, map_size and MMAP_CHECK_MAGIC xored together
+} sf_mmap_chunk;
+
+/*
+    An arena's chunks are allocated blocks of the default heap.  This descriptor sits at the start of
+    the chunk's payload; the arena's own blocks start ARENA_CHUNK_FRONT bytes into the chunk block.
+*/
+typedef struct sf_arena_chunk {
+    struct sf_arena_chunk *next; // the arena's chunks, newest first
+    char unused[24];
+} sf_arena_chunk;
+
+struct sf_arena {
+    sf_block heads[MAX_FREE_LISTS];
+    uint64_t bitmap;
+    sf_block *large_root;
+    sf_list_set lists; // points at heads, bitmap and large_root
+    sf_arena_chunk *chunks;
+#ifdef SF_THREADS
+    pthread_mutex_t lock; // the only lock an arena's blocks are ever changed under
+#endif
+};
+
+extern sf_list_set sf_default_lists;
+extern sf_block sf_extended_free_list_heads[MAX_FREE_LISTS];
+extern int sf_size_class_scheme;
+extern int sf_num_free_lists;
+extern int sf_tcache_enabled;
+extern int sf_slab_enabled;
+extern size_t sf_free_check_interval;
+extern size_t sf_quick_limit;
+extern size_t sf_mmap_threshold;
+extern size_t sf_trim_threshold;
+extern size_t sf_realloc_slack;
+extern size_t sf_profile_rate;
+extern char *sf_zero_watermark;
+extern size_t sf_tcache_count;
+extern uint64_t sf_free_list_bitmap;
+extern sf_block *sf_large_block_root;
+extern size_t sf_grow_max_pages;
 
 size_t align_size(size_t size);
 size_t get_block_size(sf_block *block_ptr);
@@ -22,39 +219,131 @@ int set_prev_alloc_bit(sf_block *block, int flag);
 int get_prev_alloc_bit(sf_block *block);
 int set_curr_alloc_bit(sf_block *block, int flag);
 int get_curr_alloc_bit(sf_block *block);
+int set_cached_bit(sf_block *block, int flag);
 sf_block *get_block_end(sf_block *block);
 sf_footer *write_footer_only_free_blocks(sf_block *block);
 sf_block *write_block_header(sf_block *block, size_t size, int prev_alloc, int alloc);
+sf_block *write_claimed_block_header(sf_block *block, size_t size, int prev_alloc);
 sf_block *unlink_block_from_free_list_return_malloc_request(sf_block *block);
 void initialize_free_lists(int index);
+void build_size_class_table();
 int get_free_list_index(size_t size);
 sf_block *get_free_list_head_to_search_for_block(size_t size);
-sf_block *find_and_remove_exact_match_free_list_block(sf_block *free_list_head_pntr, size_t size);
 sf_block *coalesce_next(sf_block *block);
 sf_block *coalesce_prev(sf_block *block);
 sf_block *coalesce(sf_block *block);
 sf_block *coalesce_if_possible(sf_block *block);
+void set_free_list_bit(sf_list_set *lists, int index);
+void clear_free_list_bit(sf_list_set *lists, int index);
 void insert_block_to_free_list(sf_block *block);
+void insert_block_to_lists(sf_list_set *lists, sf_block *block);
 sf_block *add_block_free_list_LIFO(sf_block *block);
 sf_block *split_free_block(sf_block *free_block_part_remaining_put_back, sf_block *allocated_block_to_return, size_t requested_size_plus_minBlock);
 void remove_from_free_list(sf_block *block);
+void remove_block_from_lists(sf_list_set *lists, sf_block *block);
 sf_block *allocate_block_with_split_from_free(sf_block *split_part_satisfy_malloc_request, sf_block *free_block_to_split, size_t size);
-sf_block *allocate_block_waste_space(sf_block *free_block_to_return, size_t size);
-sf_block *find_and_allocate_block_no_split_waste_space(int free_list_index_matched, size_t size);
-sf_block *find_and_allocate_block_split_no_splinter(int free_list_index_matched, size_t size);
 void *padding(void *startAddr);
-sf_block *grow_heap();
+size_t growth_pages_with_ramp(size_t missing);
+size_t heap_growth_pages(size_t size_align);
+sf_block *grow_heap(size_t npages);
 sf_block *get_free_list_block(size_t size);
 int init_heap();
 int check_initialized_heap();
 sf_block *process_payload(sf_block *free_list_block_ret);
+sf_block *create_allocated_block(sf_block *free_list_block_ret);
+sf_block *allocate_block_from_heap(size_t size_align);
+sf_block *take_free_block(size_t size_align);
 void *sf_malloc(size_t size);
+void *allocate_payload(size_t size);
 int check_pointer(void *ptr, sf_block *block);
+void release_block_to_heap(sf_block *block_freed);
 void sf_free(void *ptr);
+void free_payload(void *ptr);
+void free_block_of_size(sf_block *block_freed, size_t block_size);
+int free_check_due(void);
+int extend_block_in_place(sf_block *block, size_t size_align);
 void *sf_realloc_larger_size(void *ptr, size_t size, sf_block* client_block);
 void *sf_realloc_smaller_size(void *ptr, size_t size_req_aligned);
 void *sf_realloc(void *ptr, size_t size);
+sf_block *free_portion(sf_block *free_part, size_t size, int prev_bit);
+size_t aligned_block_offset(sf_block *block, size_t block_size, size_t size_align, size_t align);
+sf_block *carve_aligned_block(sf_list_set *lists, sf_block *free_block, size_t offset, size_t size_align);
+sf_block *first_fit_candidate(sf_list_set *lists, int index, size_t size_align);
+sf_block *next_fit_candidate(sf_list_set *lists, int index, sf_block *block);
+sf_block *take_aligned_free_block(sf_list_set *lists, size_t size_align, size_t align);
+size_t aligned_fit_size(size_t size_align, size_t align);
+sf_block *allocate_aligned_block_from_heap(size_t size_align, size_t align);
 void *sf_memalign(size_t size, size_t align);
 
+int tag_lock_index(sf_block *block);
+int lock_tag_stripes(int *stripes, int count);
+void unlock_tag_stripes(int *stripes, int count);
+void lock_block_tags(sf_block *block);
+void unlock_block_tags(sf_block *block);
+sf_block *lock_block_neighbors(sf_block *block, int *stripes, int *count);
+void release_block_locked(sf_block *block);
+sf_block *take_free_block_locked(size_t size_align);
+sf_block *take_aligned_free_block_locked(size_t size_align, size_t align);
+sf_block *grow_heap_locked(size_t npages);
+sf_block *claim_wilderness_locked(void);
+sf_block *claim_wilderness(void);
+void trim_if_due(sf_block *block_freed, size_t block_size);
+void *heap_mem_start(void);
+void *heap_mem_end(void);
+void *heap_mem_grow(void);
+size_t heap_page_size(void);
+int heap_pages_releasable(void);
+int heap_pages_zeroed(void);
+void zero_watermark_raise(sf_block *block, size_t size);
+void zero_watermark_grown(void *old_end);
+int set_sampled_bit(sf_block *block, int flag);
+void *allocate_block_payload(size_t size);
+int profile_sample_due(size_t size);
+void profile_record(void *payload, size_t size);
+void profile_retire_block(sf_block *block);
+int profile_set_rate(size_t rate);
+sf_block *allocate_block_locked(size_t size_align);
+sf_block *allocate_aligned_block_locked(size_t size_align, size_t align);
+int extend_block_locked(sf_block *block, size_t size_align);
+void shrink_block_locked(sf_block *block, size_t size_align);
+void lock_heap_for_fork(void);
+void unlock_heap_after_fork(void);
+void slab_fork_locks(int lock);
+void quick_fork_lock(int lock);
+void profile_fork_lock(int lock);
+
+sf_slab *slab_lookup(void *ptr);
+void *slab_alloc(size_t size);
+void slab_free(sf_slab *slab, void *ptr);
+void *slab_realloc(sf_slab *slab, void *ptr, size_t size);
+size_t slab_usable_size(sf_slab *slab);
+
+int region_is_active(void);
+int region_owns_block(sf_block *block);
+sf_block *region_allocate_block(size_t size_align, size_t align);
+
+sf_stat_counters *stat_slot(void);
+void stat_record_allocation(size_t requested, size_t allocated);
+void stat_record_heap_growth(void);
+
+int mmap_wanted(size_t size_align);
+int mmap_owns_block(sf_block *block);
+sf_block *mmap_allocate_block(size_t size_align, size_t align);
+void mmap_free_block(sf_block *block);
+void *mmap_realloc(void *ptr, sf_block *block, size_t size);
+
+void tree_insert(sf_block **root, sf_block *block);
+void tree_remove(sf_block **root, sf_block *block);
+sf_block *tree_best_fit(sf_block *root, size_t size);
+sf_block *tree_next_block(sf_block *root, sf_block *block);
+
+void quick_put_block(sf_block *block, size_t size_align);
+sf_block *quick_get_block(size_t size_align);
+int quick_consolidate(void);
+
+sf_block *tcache_get_block(size_t size_align);
+int tcache_put_block(sf_block *block, size_t size_align);
+void tcache_flush_bin(int bin_index, int keep);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,253 @@
+/*
+    The allocator as a drop-in replacement for malloc: built into bin/libsfmm.so by make preload, and
+    loaded into an unmodified program with
+
+        LD_PRELOAD=bin/libsfmm.so ./program
+
+    The library defines the C allocation functions (malloc, free, realloc, calloc, posix_memalign,
+    aligned_alloc, memalign, valloc, pvalloc, reallocarray and malloc_usable_size) on top of the
+    SF_THREADS build of the sf_* functions, and the dynamic linker binds the program's and every other
+    library's calls to them instead of the C library's.  Only these functions and the public sf_*
+    interface are exported (see sfmm_preload.map), so the allocator's internals can't collide with
+    the program's own symbols.
+
+    The heap uses the SF_PAGES_MMAP page provider.  The default one, sf_mem_grow from lib/sfutil.o,
+    allocates its memory with malloc, which here would be this library calling itself, and is limited
+    to a heap of about 100KB.  The provider is set up by the first call into the library, which can
+    come before any constructor has run, and is configured from the environment:
+
+        SFMM_PAGE_SIZE      bytes the heap grows by at a time (default 65536)
+        SFMM_HEAP_CAPACITY  address space reserved for the heap (default 16GB)
+        SFMM_PROFILE        sample the program's allocations (SF_OPT_PROFILE_RATE 524288) and write
+                            the heap profile to this file when it exits
+        SFMM_STATS          print sf_get_stats to stderr when the program exits
+
+    The thread cache (SF_OPT_TCACHE) is turned on.
+
+    fork() only copies the calling thread, so a heap lock held by any other thread at that moment
+    would stay locked in the child.  The library takes every heap lock around fork with
+    pthread_atfork, so the child gets the heap in a consistent state.  Arena locks are not covered;
+    a program that forks while other threads use arenas should not use them in the child.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // valloc, pvalloc, reallocarray
+#endif
+
+#include "sfmm.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+#define PRELOAD_PAGE_SIZE 65536
+#define PRELOAD_HEAP_CAPACITY ((size_t)16 << 30)
+#define PRELOAD_PROFILE_RATE 524288
+
+static int preload_state; // 0 before setup, 1 while a thread sets up, 2 once the heap can be used
+static const char *preload_profile_path;
+
+/*
+    Reads a size from the environment, or returns fallback if the variable isn't set or isn't a number.
+    Neither getenv nor strtoull allocate, so this is safe before the heap exists.
+*/
+static size_t env_size(const char *name, size_t fallback) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') return fallback;
+
+    char *end;
+    unsigned long long parsed = strtoull(value, &end, 0);
+    if (*end != '\0' || parsed == 0) return fallback;
+    return (size_t)parsed;
+}
+
+/*
+    Sets up the page provider the first time any thread gets here.  Another thread that arrives
+    while that is in progress waits for it, which is only ever a few system calls.
+*/
+static void preload_setup(void) {
+    if (__atomic_load_n(&preload_state, __ATOMIC_ACQUIRE) == 2) return;
+
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&preload_state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&preload_state, __ATOMIC_ACQUIRE) != 2) sched_yield();
+        return;
+    }
+
+    sf_page_config config = {0};
+    config.provider = SF_PAGES_MMAP;
+    config.page_size = env_size("SFMM_PAGE_SIZE", PRELOAD_PAGE_SIZE);
+    config.capacity = env_size("SFMM_HEAP_CAPACITY", PRELOAD_HEAP_CAPACITY);
+    if (!sf_set_page_provider(&config)) {
+        config.page_size = PRELOAD_PAGE_SIZE; // a bad setting falls back to the defaults
+        config.capacity = PRELOAD_HEAP_CAPACITY;
+        sf_set_page_provider(&config);
+    }
+    sf_mallopt(SF_OPT_TCACHE, 1); // programs that preload the library are mostly multithreaded
+
+    __atomic_store_n(&preload_state, 2, __ATOMIC_RELEASE);
+}
+
+/*
+    lib/sfutil.o is not position independent, so it can't be linked into a shared library.  The heap
+    never uses its provider here, so these stand in for it as a heap that has no pages and can't grow.
+*/
+void *sf_mem_start(void) {
+    return NULL;
+}
+
+void *sf_mem_end(void) {
+    return NULL;
+}
+
+void *sf_mem_grow(void) {
+    return NULL;
+}
+
+static void prepare_fork(void) {
+    lock_heap_for_fork();
+}
+
+static void release_after_fork(void) {
+    unlock_heap_after_fork();
+}
+
+/*
+    Runs when the library is loaded, after any allocation the dynamic linker made on the way: registers
+    the fork handlers and turns on profiling if SFMM_PROFILE asks for it.  Profiling is turned on here
+    rather than in preload_setup because it allocates itself the first time.
+*/
+__attribute__((constructor)) static void preload_load(void) {
+    preload_setup();
+    pthread_atfork(prepare_fork, release_after_fork, release_after_fork);
+
+    const char *profile_path = getenv("SFMM_PROFILE");
+    if (profile_path != NULL && *profile_path != '\0' && sf_mallopt(SF_OPT_PROFILE_RATE, PRELOAD_PROFILE_RATE)) {
+        preload_profile_path = profile_path;
+    }
+}
+
+/*
+    Runs when the program exits: writes the profile and the stats if they were asked for.
+*/
+__attribute__((destructor)) static void preload_unload(void) {
+    if (preload_profile_path != NULL) {
+        int fd = open(preload_profile_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            sf_profile_dump(fd);
+            close(fd);
+        }
+    }
+
+    if (getenv("SFMM_STATS") == NULL) return;
+    sf_stats stats;
+    if (!sf_get_stats(&stats)) return;
+    fprintf(stderr, "sfmm: %zu mallocs, %zu callocs, %zu frees, %zu reallocs, %zu memaligns, %zu failed\n",
+            stats.malloc_calls, stats.calloc_calls, stats.free_calls, stats.realloc_calls, stats.memalign_calls,
+            stats.failed_allocations);
+    fprintf(stderr, "sfmm: heap %zu bytes (peak %zu), %zu live, %zu free in %zu blocks, %zu mapped in %zu blocks\n",
+            stats.heap_size, stats.peak_heap_size, stats.live_bytes, stats.free_bytes, stats.free_blocks,
+            stats.mapped_bytes, stats.mapped_blocks);
+}
+
+/*
+    Returns NULL with errno set to ENOMEM, for an allocation that failed.
+*/
+static void *out_of_memory(void) {
+    errno = ENOMEM;
+    return NULL;
+}
+
+void *malloc(size_t size) {
+    preload_setup();
+    void *ptr = sf_malloc(size != 0 ? size : 1); // malloc(0) is a pointer that can be freed
+    return (ptr != NULL) ? ptr : out_of_memory();
+}
+
+void free(void *ptr) {
+    if (ptr == NULL) return;
+    sf_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) return malloc(size);
+    if (size == 0) {
+        sf_free(ptr);
+        return NULL;
+    }
+
+    void *moved = sf_realloc(ptr, size);
+    return (moved != NULL) ? moved : out_of_memory();
+}
+
+void *calloc(size_t count, size_t size) {
+    preload_setup();
+    if (count == 0 || size == 0) count = size = 1;
+
+    void *ptr = sf_calloc(count, size);
+    return (ptr != NULL) ? ptr : out_of_memory();
+}
+
+void *reallocarray(void *ptr, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) return out_of_memory();
+    return realloc(ptr, count * size);
+}
+
+/*
+    Every payload is already a multiple of MIN_BLOCK_SIZE, so smaller alignments are plain mallocs.
+    Returns NULL with errno set to EINVAL if align is not a power of two.
+*/
+static void *allocate_aligned(size_t size, size_t align) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (align <= MIN_BLOCK_SIZE) return malloc(size);
+
+    preload_setup();
+    void *ptr = sf_memalign(size != 0 ? size : 1, align);
+    return (ptr != NULL) ? ptr : out_of_memory();
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size) {
+    if (align % sizeof(void *) != 0) return EINVAL;
+
+    int saved_errno = errno; // posix_memalign reports errors only through its result
+    void *ptr = allocate_aligned(size, align);
+    int error = errno;
+    errno = saved_errno;
+    if (ptr == NULL) return error;
+
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+    return allocate_aligned(size, align);
+}
+
+void *memalign(size_t align, size_t size) {
+    return allocate_aligned(size, align);
+}
+
+void *valloc(size_t size) {
+    return allocate_aligned(size, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+void *pvalloc(size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page_size) return out_of_memory();
+    return allocate_aligned((size + page_size - 1) & ~(page_size - 1), page_size);
+}
+
+size_t malloc_usable_size(void *ptr) {
+    return sf_usable_size(ptr);
+}
@@ -0,0 +1,355 @@
+/*
+    Arenas: heaps of their own inside the default heap.
+
+    An arena has its own set of free lists (an sf_list_set, like sf_default_lists) and gets memory
+    from the default heap in chunks, each one an ordinary allocated block there.  The blocks inside
+    a chunk have the same format as the blocks of the default heap, so the free list, size class and
+    aligned fit code is shared.  A chunk is laid out like a small heap of its own:
+
+        chunk block + 0                   header of the chunk block in the default heap
+        chunk block + 8                   sf_arena_chunk descriptor, then padding
+        chunk block + ARENA_CHUNK_FRONT   first arena block, always with its prev alloc bit set
+        end of chunk - ARENA_CHUNK_BACK   epilogue (size 0, allocated), then padding
+
+    so blocks never coalesce across the ends of a chunk.  When an arena runs out of room it first tries
+    to grow its newest chunk in place with extend_block_in_place, which keeps an arena that grows on its
+    own in one contiguous chunk, and adds a new chunk only if that fails.
+
+    In SF_THREADS builds every arena has a single lock that all of its operations take.  Arenas never
+    share a lock with each other; only taking and giving back chunks goes through the default heap.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+static sf_block *chunk_block(sf_arena_chunk *chunk) {
+    return (sf_block *)((char *)chunk - sizeof(sf_header));
+}
+
+static sf_block *chunk_first_block(sf_arena_chunk *chunk) {
+    return (sf_block *)((char *)chunk_block(chunk) + ARENA_CHUNK_FRONT);
+}
+
+static sf_block *chunk_epilogue(sf_arena_chunk *chunk) {
+    return (sf_block *)((char *)get_block_end(chunk_block(chunk)) - ARENA_CHUNK_BACK);
+}
+
+/*
+    Frees a block of the arena whose header has already been written as free: merges it with the free
+    blocks on either side and puts the result on the arena's free lists.
+*/
+static void arena_coalesce_and_insert(sf_arena *arena, sf_block *block) {
+    size_t coalesced_size = get_block_size(block);
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+
+    if (!prev_bit) {
+        sf_footer *prev_footer = (sf_footer *)((char *)block - sizeof(sf_footer));
+        sf_block *prev_block = (sf_block *)((char *)block - (*prev_footer & ~0x1F));
+
+        remove_block_from_lists(&arena->lists, prev_block);
+        coalesced_size += get_block_size(prev_block);
+        prev_bit = get_prev_alloc_bit(prev_block) ? 1 : 0;
+        block = prev_block;
+        SF_STAT_ADD(coalesces, 1);
+    }
+
+    sf_block *next_block = (sf_block *)((char *)block + coalesced_size);
+    if (!get_curr_alloc_bit(next_block)) {
+        remove_block_from_lists(&arena->lists, next_block);
+        coalesced_size += get_block_size(next_block);
+        SF_STAT_ADD(coalesces, 1);
+    } else {
+        set_prev_alloc_bit(next_block, 0);
+    }
+
+    write_block_header(block, coalesced_size, prev_bit, 0);
+    insert_block_to_lists(&arena->lists, block);
+}
+
+/*
+    Takes a new chunk from the default heap with room for a free block of at least free_size bytes,
+    and makes all of it one free block.  Returns 0 with sf_errno set to ENOMEM if the heap is full.
+*/
+static int arena_add_chunk(sf_arena *arena, size_t free_size) {
+    size_t chunk_size = free_size + ARENA_CHUNK_OVERHEAD;
+    if (chunk_size < ARENA_MIN_CHUNK_SIZE) chunk_size = ARENA_MIN_CHUNK_SIZE;
+
+    sf_block *block = allocate_block_from_heap(chunk_size);
+    if (block == NULL) return 0;
+    SF_STAT_ADD(live_bytes, get_block_size(block)); // handed out by the default heap, like any block
+
+    sf_arena_chunk *chunk = (sf_arena_chunk *)((char *)block + sizeof(sf_header));
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+
+    // The heap may have handed out a few more bytes than asked for; they all go to the free block
+    write_block_header(chunk_epilogue(chunk), 0, 0, 1);
+    sf_block *first_block = write_block_header(chunk_first_block(chunk), get_block_size(block) - ARENA_CHUNK_OVERHEAD, 1, 0);
+    insert_block_to_lists(&arena->lists, first_block);
+    return 1;
+}
+
+/*
+    Grows the newest chunk in place so the free block at its end is at least free_size bytes.
+    Returns 0 if the block after the chunk in the default heap is in the way.
+*/
+static int arena_extend_chunk(sf_arena *arena, size_t free_size) {
+    sf_arena_chunk *chunk = arena->chunks;
+    if (chunk == NULL) return 0;
+
+    sf_block *old_epilogue = chunk_epilogue(chunk);
+    size_t last_free_size = 0;
+    if (!get_prev_alloc_bit(old_epilogue)) {
+        last_free_size = *(sf_footer *)((char *)old_epilogue - sizeof(sf_footer)) & ~0x1F;
+    }
+
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(old_epilogue)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+
+    size_t old_chunk_size = get_block_size(chunk_block(chunk));
+    if (!extend_block_in_place(chunk_block(chunk), old_chunk_size + free_size - last_free_size)) return 0;
+    SF_STAT_ADD(live_bytes, get_block_size(chunk_block(chunk)) - old_chunk_size);
+
+    // The old epilogue becomes the header of a free block that runs up to the new one
+    write_block_header(chunk_epilogue(chunk), 0, 0, 1);
+    write_block_header(old_epilogue, get_block_size(chunk_block(chunk)) - old_chunk_size, prev_bit, 0);
+    arena_coalesce_and_insert(arena, old_epilogue);
+    return 1;
+}
+
+/*
+    Returns an allocated block of size_align bytes from the arena whose payload is a multiple of align,
+    growing the arena if nothing fits.  Returns NULL with sf_errno set to ENOMEM.  The arena lock is held.
+*/
+static sf_block *arena_allocate(sf_arena *arena, size_t size_align, size_t align) {
+    sf_block *block = take_aligned_free_block(&arena->lists, size_align, align);
+    if (block != NULL) return block;
+
+    // Either way the arena now has a free block that holds an aligned fit
+    size_t fit_size = aligned_fit_size(size_align, align);
+    if (!arena_extend_chunk(arena, fit_size) && !arena_add_chunk(arena, fit_size)) {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+    return take_aligned_free_block(&arena->lists, size_align, align);
+}
+
+/*
+    Checks ptr the way check_pointer does, against the arena's chunks instead of the whole heap.
+    Returns 1 if it is not the payload of an allocated block of the arena.  The arena lock is held.
+*/
+static int arena_check_pointer(sf_arena *arena, void *ptr, sf_block *block) {
+    if ((uintptr_t)ptr & 31) return 1;
+
+    sf_arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL && (block < chunk_first_block(chunk) || block >= chunk_epilogue(chunk))) {
+        chunk = chunk->next;
+    }
+    if (chunk == NULL) return 1;
+
+    if (get_block_size(block) < 32) return 1;
+    if (get_block_size(block) % 32 != 0) return 1;
+    if (get_block_end(block) > chunk_epilogue(chunk)) return 1;
+    if (!get_curr_alloc_bit(block)) return 1;
+
+    if (!get_prev_alloc_bit(block)) {
+        if (block == chunk_first_block(chunk)) return 1;
+
+        sf_footer *prev_footer = (sf_footer *)((char *)block - sizeof(sf_footer));
+        sf_block *prev_block = (sf_block *)((char *)block - (*prev_footer & ~0x1F));
+        if (prev_block < chunk_first_block(chunk) || get_curr_alloc_bit(prev_block)) return 1;
+    }
+    return 0;
+}
+
+static void arena_release(sf_arena *arena, sf_block *block) {
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+
+    write_block_header(block, get_block_size(block), prev_bit, 0);
+    arena_coalesce_and_insert(arena, block);
+}
+
+/*
+    Resizes an allocated block of the arena where it is: shrinking splits off the tail, growing absorbs
+    the free block after it.  Returns 0 if the block has to be moved.  The arena lock is held.
+*/
+static int arena_resize_in_place(sf_arena *arena, sf_block *block, size_t size_align) {
+    size_t block_size = get_block_size(block);
+    sf_block *next_block = get_block_end(block);
+
+    size_t available = block_size;
+    if (!get_curr_alloc_bit(next_block)) available += get_block_size(next_block);
+    if (available < size_align) return 0;
+
+    if (available > block_size) remove_block_from_lists(&arena->lists, next_block);
+
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+
+    if (available - size_align >= MIN_BLOCK_SIZE) {
+        write_block_header(block, size_align, prev_bit, 1);
+        sf_block *tail = write_block_header(get_block_end(block), available - size_align, 1, 0);
+        arena_coalesce_and_insert(arena, tail);
+        SF_STAT_ADD(splits, 1);
+    } else {
+        write_block_header(block, available, prev_bit, 1);
+        set_prev_alloc_bit(get_block_end(block), 1);
+    }
+    return 1;
+}
+
+sf_arena *sf_arena_create(void) {
+    sf_block *block = allocate_block_from_heap(align_size(sizeof(sf_arena)));
+    if (block == NULL) return NULL;
+    SF_STAT_ADD(live_bytes, get_block_size(block));
+
+    sf_arena *arena = (sf_arena *)((char *)block + sizeof(sf_header));
+    for (int index = 0; index < sf_num_free_lists; index++) {
+        arena->heads[index].body.links.next = &arena->heads[index];
+        arena->heads[index].body.links.prev = &arena->heads[index];
+    }
+    arena->bitmap = 0;
+    arena->lists.heads = arena->heads;
+    arena->lists.bitmap = &arena->bitmap;
+    arena->large_root = NULL;
+    arena->lists.large_root = &arena->large_root;
+    arena->chunks = NULL;
+#ifdef SF_THREADS
+    pthread_mutex_init(&arena->lock, NULL);
+#endif
+    return arena;
+}
+
+void sf_arena_destroy(sf_arena *arena) {
+    if (arena == NULL) return;
+
+    sf_arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        sf_arena_chunk *next_chunk = chunk->next;
+        SF_STAT_SUB(live_bytes, get_block_size(chunk_block(chunk)));
+        release_block_to_heap(chunk_block(chunk));
+        chunk = next_chunk;
+    }
+
+#ifdef SF_THREADS
+    pthread_mutex_destroy(&arena->lock);
+#endif
+    sf_block *arena_block = (sf_block *)((char *)arena - sizeof(sf_header));
+    SF_STAT_SUB(live_bytes, get_block_size(arena_block));
+    release_block_to_heap(arena_block);
+}
+
+void *sf_arena_malloc(sf_arena *arena, size_t size) {
+    if (arena == NULL) return sf_malloc(size);
+
+    sf_errno = 0;
+    if (size == 0) return NULL;
+
+    size_t size_align = align_size(size);
+    if (!size_align) return NULL;
+
+    SF_LOCK(arena->lock);
+    sf_block *block = arena_allocate(arena, size_align, MIN_BLOCK_SIZE);
+    SF_UNLOCK(arena->lock);
+    if (block == NULL) return NULL;
+
+    return (void *)((char *)block + sizeof(sf_header));
+}
+
+void sf_arena_free(sf_arena *arena, void *ptr) {
+    if (arena == NULL) {
+        sf_free(ptr);
+        return;
+    }
+
+    sf_block *block = (sf_block *)((char *)ptr - sizeof(sf_header));
+
+    SF_LOCK(arena->lock);
+    if (arena_check_pointer(arena, ptr, block)) {
+        SF_UNLOCK(arena->lock);
+        sf_errno = EINVAL;
+        abort();
+    }
+
+    arena_release(arena, block);
+    SF_UNLOCK(arena->lock);
+}
+
+void *sf_arena_realloc(sf_arena *arena, void *ptr, size_t size) {
+    if (arena == NULL) return sf_realloc(ptr, size);
+
+    sf_block *block = (sf_block *)((char *)ptr - sizeof(sf_header));
+
+    SF_LOCK(arena->lock);
+    if (arena_check_pointer(arena, ptr, block)) {
+        SF_UNLOCK(arena->lock);
+        sf_errno = EINVAL;
+        return NULL;
+    }
+
+    if (size == 0) {
+        arena_release(arena, block);
+        SF_UNLOCK(arena->lock);
+        return NULL;
+    }
+
+    size_t size_align = align_size(size);
+    void *payload = ptr;
+    if (size_align != get_block_size(block) && !arena_resize_in_place(arena, block, size_align)) {
+        sf_block *larger_block = arena_allocate(arena, size_align, MIN_BLOCK_SIZE);
+        payload = NULL;
+        if (larger_block != NULL) {
+            payload = (void *)((char *)larger_block + sizeof(sf_header));
+            memcpy(payload, ptr, get_block_size(block) - sizeof(sf_header));
+            arena_release(arena, block);
+        }
+    }
+    SF_UNLOCK(arena->lock);
+
+    return payload;
+}
+
+void *sf_arena_memalign(sf_arena *arena, size_t size, size_t align) {
+    if (arena == NULL) return sf_memalign(size, align);
+
+    if (align < MIN_BLOCK_SIZE || (align & (align - 1)) != 0) {
+        sf_errno = EINVAL;
+        return NULL;
+    }
+    if (size == 0) return NULL;
+
+    size_t size_align = align_size(size);
+    if (!size_align || size_align >= SIZE_MAX - align) {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    SF_LOCK(arena->lock);
+    sf_block *block = arena_allocate(arena, size_align, align);
+    SF_UNLOCK(arena->lock);
+    if (block == NULL) return NULL;
+
+    return (void *)((char *)block + sizeof(sf_header));
+}
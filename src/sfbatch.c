@@ -0,0 +1,158 @@
+/*
+    Batch allocation and batch free.
+
+    sf_malloc_batch takes one block big enough for all n objects from the heap, so the heap is
+    searched (and split) once, and then cuts it into n allocated blocks by writing their headers.
+
+    sf_free_batch sorts the pointers by address so blocks that sit next to each other in the heap are
+    next to each other in the array.  Each run of adjacent blocks is turned into one allocated block
+    covering the whole run and released once, so the run costs a single coalesce and a single free
+    list insertion however many blocks it had.
+
+    Slab objects and region blocks have their own way of being allocated and freed, so for them
+    both functions fall back to doing one object at a time.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+/*
+    Cuts an allocated block of count * size_align bytes (or a little more) into count allocated blocks
+    of size_align bytes; the last one keeps whatever is left over.  The first header can have its prev
+    alloc bit flipped by a neighbor at any time, so it is rewritten under its stripe; the others can't
+    be reached by anyone until the blocks are handed out.
+*/
+static void carve_batch_block(sf_block *block, size_t size_align, size_t count, void **out) {
+    size_t block_size = get_block_size(block);
+
+#ifdef SF_THREADS
+    lock_block_tags(block);
+#endif
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    write_block_header(block, (count == 1) ? block_size : size_align, prev_bit, 1);
+#ifdef SF_THREADS
+    unlock_block_tags(block);
+#endif
+    out[0] = (char *)block + sizeof(sf_header);
+
+    for (size_t i = 1; i < count; i++) {
+        sf_block *next_block = (sf_block *)((char *)block + i * size_align);
+        size_t next_size = (i == count - 1) ? block_size - i * size_align : size_align;
+        write_block_header(next_block, next_size, 1, 1);
+        out[i] = (char *)next_block + sizeof(sf_header);
+    }
+}
+
+size_t sf_malloc_batch(size_t size, size_t n, void **out) {
+    sf_errno = 0;
+    SF_STAT_ADD(malloc_calls, n);
+
+    if (size == 0 || n == 0) return 0;
+    if (out == NULL) {
+        sf_errno = EINVAL;
+        return 0;
+    }
+
+    size_t size_align = align_size(size);
+    size_t done = 0;
+
+    // One block for the whole batch, unless it is too big for the heap or can't come from the free lists
+    int one_block = size_align != 0 && !region_is_active() && !(sf_slab_enabled && size <= SLAB_MAX_SIZE) &&
+                    !mmap_wanted(size_align) && n <= SIZE_MAX / size_align;
+    if (one_block) {
+        sf_block *block = allocate_block_from_heap(size_align * n);
+        if (block != NULL) {
+            stat_record_allocation(size * n, get_block_size(block));
+            carve_batch_block(block, size_align, n, out);
+            return n;
+        }
+        sf_errno = 0; // a batch that doesn't fit in one block may still fit in pieces
+    }
+
+    while (done < n && (out[done] = allocate_payload(size)) != NULL) {
+        done++;
+    }
+    if (done < n) SF_STAT_ADD(failed_allocations, n - done);
+    return done;
+}
+
+static int compare_addresses(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void * const *)a;
+    uintptr_t y = (uintptr_t)*(void * const *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+    Releases a run of adjacent allocated blocks, starting at run_start and run_size bytes long,
+    as one block.
+*/
+static void release_batch_run(sf_block *run_start, size_t run_size) {
+#ifdef SF_THREADS
+    lock_block_tags(run_start);
+#endif
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(run_start)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    write_block_header(run_start, run_size, prev_bit, 1);
+#ifdef SF_THREADS
+    unlock_block_tags(run_start);
+#endif
+
+    release_block_to_heap(run_start);
+}
+
+void sf_free_batch(void **ptrs, size_t n) {
+    SF_STAT_ADD(free_calls, n);
+    if (n == 0) return;
+    if (ptrs == NULL) {
+        sf_errno = EINVAL;
+        abort();
+    }
+
+    qsort(ptrs, n, sizeof(void *), compare_addresses);
+
+    sf_block *run_start = NULL;
+    size_t run_size = 0;
+    for (size_t i = 0; i < n; i++) {
+        void *ptr = ptrs[i];
+        sf_block *block = (sf_block *)((char *)ptr - sizeof(sf_header));
+
+        if (i > 0 && ptr == ptrs[i - 1]) {
+            sf_errno = EINVAL; // the same pointer twice in one batch is a double free
+            abort();
+        }
+        if (slab_lookup(ptr) != NULL || mmap_owns_block(block)) {
+            free_payload(ptr);
+            continue;
+        }
+        if (check_pointer(ptr, block)) {
+            sf_errno = EINVAL;
+            abort();
+        }
+        if (region_owns_block(block)) continue; // given back all at once by sf_region_release
+        if (block->header & SAMPLED_BLOCK) profile_retire_block(block);
+        SF_STAT_SUB(live_bytes, get_block_size(block));
+
+        if (run_start != NULL && (char *)run_start + run_size == (char *)block) {
+            run_size += get_block_size(block);
+            continue;
+        }
+        if (run_start != NULL) release_batch_run(run_start, run_size);
+        run_start = block;
+        run_size = get_block_size(block);
+    }
+    if (run_start != NULL) release_batch_run(run_start, run_size);
+}
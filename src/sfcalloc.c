@@ -0,0 +1,146 @@
+/*
+    sf_calloc: zeroed allocations that only clear the bytes that may not be zero already.
+
+    Pages the page provider adds to the heap are zero filled (see heap_pages_zeroed), and they stay
+    that way until a block over them is handed out and the caller writes to it.  The zero watermark
+    records how far that has happened:
+
+        every byte of the heap at or above sf_zero_watermark is zero, except for the header, links
+        and footer of the free block it is part of, and the epilogue
+
+    write_block_header raises the watermark past every block it marks allocated, and past the
+    header and links of the block that follows it, which may become stale bytes inside a bigger
+    free block when the two are coalesced later.  A growth raises it past the old epilogue, which
+    becomes the header of the new pages and may be left behind with its links and the footer in
+    front of it, or to the new end of the heap when the provider's pages aren't zero.  Blocks that
+    are marked allocated only while the heap works on them (a growth's new pages, the wilderness
+    claimed by a trim or a region, the parts a split cuts off and releases right away) use
+    write_claimed_block_header, which leaves it alone; each of their headers is at a place the
+    watermark already covers.  The watermark only ever moves up.
+
+    The thread that raises the watermark records where it was in zero_clean_from.  sf_calloc clears
+    that before it allocates, so afterwards it knows the allocation took memory from above the old
+    watermark, and that the block's bytes from there on only need their free block metadata cleared.
+    Every raise of one allocation comes from the same free block, taken while no other thread can
+    reach it, so no bytes another thread wrote can be above the recorded position.  A block that
+    didn't raise the watermark (a reused block, a thread cache hit) is cleared in full.  A mapped
+    block is fresh from mmap and isn't cleared at all.
+
+    The clearing itself is memset, which the C library already implements with the widest vector
+    stores the machine has, and with non-temporal stores for clears larger than the cache.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+char *sf_zero_watermark; // NULL until the heap exists
+
+static SF_THREAD_LOCAL char *zero_clean_from; // the watermark before this thread's last raise, NULL if sf_calloc hasn't seen one
+
+/*
+    Moves the watermark up to target if it is below.  Returns where it was, or NULL if it was
+    already at or above target.
+*/
+static char *raise_watermark(char *target) {
+    char *watermark = __atomic_load_n(&sf_zero_watermark, __ATOMIC_RELAXED);
+    while (watermark < target) {
+        if (__atomic_compare_exchange_n(&sf_zero_watermark, &watermark, target, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return watermark;
+        }
+    }
+    return NULL;
+}
+
+/*
+    Called by write_block_header for an allocated block that reaches past the watermark.
+    Epilogues and mapped blocks are not part of the heap's memory and are left out.
+*/
+void zero_watermark_raise(sf_block *block, size_t size) {
+    if (size == 0 || (void *)block < heap_mem_start() || (void *)block >= heap_mem_end()) return;
+
+    char *watermark = raise_watermark((char *)block + size + FREE_BLOCK_FRONT);
+    if (watermark != NULL && zero_clean_from == NULL) zero_clean_from = watermark;
+}
+
+/*
+    Called after heap_mem_grow added pages past old_end, with sf_grow_lock held.
+*/
+void zero_watermark_grown(void *old_end) {
+    if (!heap_pages_zeroed()) {
+        raise_watermark(heap_mem_end());
+        return;
+    }
+    raise_watermark((char *)old_end - sizeof(sf_header) + FREE_BLOCK_FRONT);
+}
+
+/*
+    Clears the first size bytes of the payload of a block that was just allocated.
+*/
+static void clear_block_payload(sf_block *block, char *payload, size_t size) {
+    if (mmap_owns_block(block)) return; // a new mapping is zero filled
+
+    char *payload_end = payload + size;
+    char *clean = zero_clean_from;
+    if (clean == NULL || clean > payload_end) clean = payload_end;
+    if (clean < payload) clean = payload;
+    memset(payload, 0, clean - payload);
+    if (clean == payload_end) return;
+
+    // The free block the block was cut from had its header and links at its start and its footer
+    // at its end, and the block may have started or ended with it
+    char *links_end = (char *)block + FREE_BLOCK_FRONT;
+    if (links_end > clean) memset(clean, 0, ((links_end < payload_end) ? links_end : payload_end) - clean);
+
+    char *footer = (char *)block + get_block_size(block) - sizeof(sf_footer);
+    if (footer < payload_end) {
+        char *footer_start = (footer > clean) ? footer : clean;
+        memset(footer_start, 0, payload_end - footer_start);
+    }
+}
+
+/*
+    Allocates count objects of size bytes each, all zero.  Small requests are allocated like
+    sf_malloc and cleared in full; larger ones get a block with a header so that the zero watermark
+    can tell which of its bytes need clearing.
+*/
+void *sf_calloc(size_t count, size_t size) {
+    sf_errno = 0;
+    SF_STAT_ADD(calloc_calls, 1);
+
+    if (size != 0 && count > SIZE_MAX / size) {
+        SF_STAT_ADD(failed_allocations, 1);
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+    size_t total = count * size;
+    if (total == 0) return NULL;
+
+    int sampled = sf_profile_rate != 0 && profile_sample_due(total);
+    if (!sampled && total <= SLAB_MAX_SIZE) { // could be a slab object, which has no header
+        void *payload = allocate_payload(total);
+        if (payload == NULL) {
+            SF_STAT_ADD(failed_allocations, 1);
+            return NULL;
+        }
+        return memset(payload, 0, total);
+    }
+
+    zero_clean_from = NULL;
+    char *payload = allocate_block_payload(total);
+    if (payload == NULL) {
+        SF_STAT_ADD(failed_allocations, 1);
+        return NULL;
+    }
+    clear_block_payload((sf_block *)(payload - sizeof(sf_header)), payload, total);
+
+    if (sampled) profile_record(payload, total);
+    return payload;
+}
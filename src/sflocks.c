@@ -0,0 +1,599 @@
+/*
+    Thread-safe versions of the heap operations, compiled in SF_THREADS builds only.
+
+    Instead of one mutex around the whole heap there are three kinds of locks:
+
+    sf_free_list_locks[i]  One per size class.  Protects the links of free list i.
+    tag_locks[]            Striped by block address.  The stripe of a block's header protects
+                           that block's header and footer, and whether the block is on a free list.
+                           A free block can only be unlinked while holding its stripe, so holding
+                           the stripe of a block whose header says free means it is on its list.
+    sf_grow_lock           Serializes heap initialization and heap_mem_grow.
+
+    Locks are always taken in the order: grow lock, tag stripes (ascending stripe index), free list
+    locks.  The only place that needs a stripe while already holding a free list lock is the search
+    for a block to allocate; it uses trylock there and skips the block if the stripe is busy.
+
+    Coalescing needs the stripes of the block being freed, of the block after it and, when the
+    previous block is free, of the block before it.  The previous block can only be located by
+    reading its footer, which may change before its stripe is held, so the stripes are taken in
+    order and the neighbors are validated afterwards; if they changed, everything is released
+    and the attempt starts over.
+
+    While a release coalesces, the free neighbors it merges are on no free list, and the part split
+    off a block taken for an allocation is marked allocated until it is released.  A search that
+    runs at that moment misses memory that is free, and would grow the heap or fail with ENOMEM
+    for nothing.  Each of these is a release window (open_release_window): a search that misses
+    while one was open waits for the windows open when it started to close, and then searches
+    once more.  Windows are counted in two halves, so windows opened after a waiter started don't
+    keep it waiting (see wait_for_release_windows).  release_wait_lock is only ever held on its own.
+*/
+
+#ifdef SF_THREADS
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+pthread_mutex_t sf_free_list_locks[MAX_FREE_LISTS] = {
+    [0 ... MAX_FREE_LISTS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+pthread_mutex_t sf_grow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int release_epoch; // new windows are counted in release_open[release_epoch & 1]
+static unsigned int release_open[2];
+static uint64_t release_opened; // every window ever opened, so a search can tell one opened while it ran
+static int release_waiters;
+static pthread_mutex_t release_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t release_closed = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t tag_locks[TAG_LOCK_STRIPES] = {
+    [0 ... TAG_LOCK_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+int tag_lock_index(sf_block *block) {
+    // Headers sit 8 bytes below a 32 byte boundary, so every header in a run of blocks gets its own stripe
+    return (int)(((uintptr_t)block >> 5) & (TAG_LOCK_STRIPES - 1));
+}
+
+/*
+    Sorts the stripe indexes, drops duplicates and locks them in ascending order.
+    Returns the number of distinct stripes locked (at most 3 are ever passed in).
+*/
+int lock_tag_stripes(int *stripes, int count) {
+    for (int i = 1; i < count; i++) {
+        int stripe = stripes[i];
+        int j = i - 1;
+        while (j >= 0 && stripes[j] > stripe) {
+            stripes[j + 1] = stripes[j];
+            j--;
+        }
+        stripes[j + 1] = stripe;
+    }
+
+    int distinct = 0;
+    for (int i = 0; i < count; i++) {
+        if (distinct > 0 && stripes[distinct - 1] == stripes[i]) continue;
+        stripes[distinct++] = stripes[i];
+    }
+
+    for (int i = 0; i < distinct; i++) {
+        pthread_mutex_lock(&tag_locks[stripes[i]]);
+    }
+    return distinct;
+}
+
+void unlock_tag_stripes(int *stripes, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&tag_locks[stripes[i]]);
+    }
+}
+
+void lock_block_tags(sf_block *block) {
+    pthread_mutex_lock(&tag_locks[tag_lock_index(block)]);
+}
+
+void unlock_block_tags(sf_block *block) {
+    pthread_mutex_unlock(&tag_locks[tag_lock_index(block)]);
+}
+
+/*
+    Used while a free list lock is held, so it may not wait: tries to take the stripes of a block
+    and of the block after it.  Returns 1 with both held, or 0 with neither held.
+*/
+static int trylock_block_and_next(sf_block *block, sf_block *next_block) {
+    int block_stripe = tag_lock_index(block);
+    int next_stripe = tag_lock_index(next_block);
+
+    if (pthread_mutex_trylock(&tag_locks[block_stripe]) != 0) return 0;
+    if (next_stripe != block_stripe && pthread_mutex_trylock(&tag_locks[next_stripe]) != 0) {
+        pthread_mutex_unlock(&tag_locks[block_stripe]);
+        return 0;
+    }
+    return 1;
+}
+
+static void unlock_block_and_next(sf_block *block, sf_block *next_block) {
+    int block_stripe = tag_lock_index(block);
+    int next_stripe = tag_lock_index(next_block);
+
+    if (next_stripe != block_stripe) pthread_mutex_unlock(&tag_locks[next_stripe]);
+    pthread_mutex_unlock(&tag_locks[block_stripe]);
+}
+
+static void unlink_free_block_locked(sf_block *block) {
+    int index = get_free_list_index(get_block_size(block));
+
+    pthread_mutex_lock(&sf_free_list_locks[index]);
+    remove_from_free_list(block);
+    pthread_mutex_unlock(&sf_free_list_locks[index]);
+}
+
+static void insert_free_block_locked(sf_block *block) {
+    int index = get_free_list_index(get_block_size(block));
+
+    pthread_mutex_lock(&sf_free_list_locks[index]);
+    insert_block_to_free_list(block);
+    pthread_mutex_unlock(&sf_free_list_locks[index]);
+}
+
+/*
+    Locks the stripes of a block owned by the caller, of the block after it and, when the header
+    says the previous block is free, of the block its footer points to.  The previous block is
+    found without holding its stripe, so after everything is locked the guess is checked again and
+    the whole thing is retried if it changed.  Returns the previous block, or NULL if the header
+    says it is allocated; the stripes taken are left in stripes/count for unlock_tag_stripes.
+*/
+sf_block *lock_block_neighbors(sf_block *block, int *stripes, int *count) {
+    while (1) {
+        lock_block_tags(block);
+        size_t header_seen = block->header;
+        sf_block *next_block = get_block_end(block);
+        sf_block *prev_block = NULL;
+        size_t prev_size = 0;
+        if (!(header_seen & PREV_BLOCK_ALLOC)) {
+            prev_size = *(sf_footer *)((char *)block - sizeof(sf_footer)) & ~0x1F;
+            prev_block = (sf_block *)((char *)block - prev_size);
+        }
+        unlock_block_tags(block);
+
+        *count = 0;
+        stripes[(*count)++] = tag_lock_index(block);
+        stripes[(*count)++] = tag_lock_index(next_block);
+        if (prev_block != NULL) stripes[(*count)++] = tag_lock_index(prev_block);
+        *count = lock_tag_stripes(stripes, *count);
+
+        if (block->header != header_seen) {
+            unlock_tag_stripes(stripes, *count); // the previous block was allocated or freed meanwhile
+            continue;
+        }
+        if (prev_block != NULL && (*(sf_footer *)((char *)block - sizeof(sf_footer)) & ~0x1F) != prev_size) {
+            unlock_tag_stripes(stripes, *count); // the previous block was merged with its own neighbor
+            continue;
+        }
+        return prev_block;
+    }
+}
+
+/*
+    Called before free memory is taken off the free lists for a moment.  Returns the half the
+    window is counted in, to be passed to close_release_window once the memory is back.
+*/
+static int open_release_window(void) {
+    int half = (int)(__atomic_load_n(&release_epoch, __ATOMIC_SEQ_CST) & 1);
+    __atomic_add_fetch(&release_open[half], 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&release_opened, 1, __ATOMIC_SEQ_CST);
+    return half;
+}
+
+static void close_release_window(int half) {
+    if (__atomic_sub_fetch(&release_open[half], 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&release_waiters, __ATOMIC_SEQ_CST) != 0) {
+        pthread_mutex_lock(&release_wait_lock);
+        pthread_cond_broadcast(&release_closed);
+        pthread_mutex_unlock(&release_wait_lock);
+    }
+}
+
+static int release_windows_open(void) {
+    return __atomic_load_n(&release_open[0], __ATOMIC_SEQ_CST) != 0 || __atomic_load_n(&release_open[1], __ATOMIC_SEQ_CST) != 0;
+}
+
+/*
+    Waits until every window that was open when it was called has closed.  The half that counts
+    the windows of the previous epoch is waited out first; then the epoch moves on, so new windows
+    are counted in that half, and the half of the old epoch is waited out.  A waiter that finds
+    the epoch already moved on by another waiter only has to wait for what that one waits for,
+    and once the epoch has moved twice every window it could have seen has closed.
+*/
+static void wait_for_release_windows(void) {
+    pthread_mutex_lock(&release_wait_lock);
+    __atomic_add_fetch(&release_waiters, 1, __ATOMIC_SEQ_CST);
+
+    unsigned int epoch = __atomic_load_n(&release_epoch, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&release_epoch, __ATOMIC_SEQ_CST) == epoch &&
+           __atomic_load_n(&release_open[(epoch + 1) & 1], __ATOMIC_SEQ_CST) != 0) {
+        pthread_cond_wait(&release_closed, &release_wait_lock);
+    }
+    if (__atomic_load_n(&release_epoch, __ATOMIC_SEQ_CST) == epoch) {
+        __atomic_store_n(&release_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&release_closed);
+    }
+    while (__atomic_load_n(&release_epoch, __ATOMIC_SEQ_CST) - epoch < 2 &&
+           __atomic_load_n(&release_open[epoch & 1], __ATOMIC_SEQ_CST) != 0) {
+        pthread_cond_wait(&release_closed, &release_wait_lock);
+    }
+
+    __atomic_sub_fetch(&release_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&release_wait_lock);
+}
+
+/*
+    Frees a block owned by the caller (its header says allocated), coalescing it with free
+    neighbors and inserting the result into its free list.
+*/
+void release_block_locked(sf_block *block) {
+    int stripes[3];
+    int count;
+    sf_block *prev_block = lock_block_neighbors(block, stripes, &count);
+    sf_block *next_block = get_block_end(block);
+
+    sf_block *coalesced_block = block;
+    size_t coalesced_size = get_block_size(block);
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+
+    int window = -1;
+    if (prev_block != NULL || !get_curr_alloc_bit(next_block)) window = open_release_window();
+
+    if (prev_block != NULL) {
+        SF_STAT_ADD(coalesces, 1);
+        unlink_free_block_locked(prev_block);
+        coalesced_block = prev_block;
+        coalesced_size += get_block_size(prev_block);
+        prev_bit = get_prev_alloc_bit(prev_block) ? 1 : 0;
+    }
+
+    if (!get_curr_alloc_bit(next_block)) {
+        SF_STAT_ADD(coalesces, 1);
+        unlink_free_block_locked(next_block); // the block after it already has prev alloc 0
+        coalesced_size += get_block_size(next_block);
+    } else {
+        set_prev_alloc_bit(next_block, 0);
+    }
+
+    write_block_header(coalesced_block, coalesced_size, prev_bit, 0);
+    insert_free_block_locked(coalesced_block);
+    if (window >= 0) close_release_window(window);
+
+    unlock_tag_stripes(stripes, count);
+}
+
+/*
+    Searches the free lists for a block of at least size_align bytes and takes it, splitting off
+    the rest when it is big enough to be a block of its own.  Never grows the heap.  Returns NULL
+    only when no free block is large enough; blocks that are busy in another thread are retried,
+    and a search that missed while a release window was open is repeated once the window closed.
+*/
+sf_block *take_free_block_locked(size_t size_align) {
+    return take_aligned_free_block_locked(size_align, MIN_BLOCK_SIZE); // every payload is 32 byte aligned
+}
+
+/*
+    take_free_block_locked for a block whose payload is a multiple of align.  A free block is taken
+    if an aligned block fits anywhere inside it (see aligned_block_offset); the part in front of the
+    aligned block is split off and released the same way as the part after it.
+*/
+sf_block *take_aligned_free_block_locked(size_t size_align, size_t align) {
+    int waited = 0;
+    while (1) {
+        int skipped_busy_block = 0;
+        uint64_t windows_seen = __atomic_load_n(&release_opened, __ATOMIC_SEQ_CST);
+        int windows_were_open = release_windows_open();
+
+        for (int index = get_free_list_index(size_align); index < sf_num_free_lists; index++) {
+            // Read without the list lock: a list that just became non-empty is picked up by the caller's retry
+            if (!(__atomic_load_n(&sf_free_list_bitmap, __ATOMIC_RELAXED) & FREE_LIST_BIT(index))) continue;
+
+            pthread_mutex_lock(&sf_free_list_locks[index]);
+            for (sf_block *block = first_fit_candidate(&sf_default_lists, index, size_align); block != NULL;
+                 block = next_fit_candidate(&sf_default_lists, index, block)) {
+                size_t block_size = get_block_size(block);
+                size_t offset = aligned_block_offset(block, block_size, size_align, align);
+                if (offset == NO_ALIGNED_FIT) continue;
+
+                sf_block *next_block = get_block_end(block);
+                if (!trylock_block_and_next(block, next_block)) {
+                    skipped_busy_block = 1;
+                    continue;
+                }
+
+                // The parts split off are out of sight from here until they are released
+                int split_off = offset > 0 || block_size - offset - size_align >= MIN_BLOCK_SIZE;
+                int window = split_off ? open_release_window() : -1;
+                remove_from_free_list(block);
+                pthread_mutex_unlock(&sf_free_list_locks[index]);
+
+                int prev_bit = 0;
+                if (get_prev_alloc_bit(block)) {
+                    // means previous bit is allocated set to 1
+                    prev_bit = 1;
+                }
+
+                // The parts split off stay marked allocated (and unreachable) until they are released below
+                sf_block *front = NULL;
+                sf_block *aligned_block = block;
+                if (offset > 0) {
+                    front = write_claimed_block_header(block, offset, prev_bit);
+                    aligned_block = (sf_block *)((char *)block + offset);
+                    prev_bit = 1;
+                    SF_STAT_ADD(splits, 1);
+                }
+
+                size_t remaining_size = block_size - offset;
+                sf_block *remainder = NULL;
+                if (remaining_size - size_align >= MIN_BLOCK_SIZE) {
+                    write_block_header(aligned_block, size_align, prev_bit, 1);
+                    remainder = get_block_end(aligned_block);
+                    write_claimed_block_header(remainder, remaining_size - size_align, 1);
+                    SF_STAT_ADD(splits, 1);
+                } else {
+                    write_block_header(aligned_block, remaining_size, prev_bit, 1);
+                }
+                set_prev_alloc_bit(next_block, 1);
+
+                unlock_block_and_next(block, next_block);
+
+                if (front != NULL) release_block_locked(front);
+                if (remainder != NULL) release_block_locked(remainder);
+                if (window >= 0) close_release_window(window);
+                return aligned_block;
+            }
+            pthread_mutex_unlock(&sf_free_list_locks[index]);
+        }
+
+        if (!skipped_busy_block) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST); // the reads of the lists come before the check
+            if (waited || (!windows_were_open && __atomic_load_n(&release_opened, __ATOMIC_SEQ_CST) == windows_seen)) {
+                return NULL;
+            }
+            wait_for_release_windows();
+            waited = 1;
+            continue;
+        }
+        sched_yield(); // a fitting block exists but another thread is working next to it
+    }
+}
+
+/*
+    Adds up to npages pages to the heap and releases them as one free block.  The caller must hold
+    sf_grow_lock.  Returns NULL with sf_errno set to ENOMEM only if not a single page could be added,
+    and NULL without adding anything while a region is held (see sfregion.c).
+*/
+sf_block *grow_heap_locked(size_t npages) {
+    if (region_is_active()) return NULL;
+
+    sf_block *original_epilogue = heap_mem_end() - sizeof(sf_footer);
+    void *old_memory_end = heap_mem_end();
+
+    size_t pages_grown = 0;
+    while (pages_grown < npages && heap_mem_grow() != NULL) {
+        pages_grown++;
+    }
+    if (pages_grown == 0) {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+    stat_record_heap_growth();
+    zero_watermark_grown(old_memory_end);
+
+    // The new epilogue can't be reached by anyone until the old one is turned into a block
+    sf_block *new_epilogue = heap_mem_end() - EPILOGUE_SIZE;
+    write_block_header(new_epilogue, 0, 1, 1);
+
+    lock_block_tags(original_epilogue);
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(original_epilogue)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    write_claimed_block_header(original_epilogue, heap_mem_end() - old_memory_end, prev_bit);
+    unlock_block_tags(original_epilogue);
+
+    release_block_locked(original_epilogue);
+    return original_epilogue;
+}
+
+/*
+    Takes the free block in front of the epilogue off its free list and marks it allocated, for a
+    region that is starting or a trim.  The caller must hold sf_grow_lock so the epilogue can't move.  Returns
+    the block, or the epilogue if the last block of the heap is allocated.
+*/
+sf_block *claim_wilderness_locked(void) {
+    sf_block *epilogue = heap_mem_end() - EPILOGUE_SIZE;
+    int stripes[3];
+    int count;
+    sf_block *wilderness = lock_block_neighbors(epilogue, stripes, &count);
+    if (wilderness == NULL) {
+        unlock_tag_stripes(stripes, count);
+        return epilogue;
+    }
+
+    unlink_free_block_locked(wilderness);
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(wilderness)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    write_claimed_block_header(wilderness, get_block_size(wilderness), prev_bit);
+    set_prev_alloc_bit(epilogue, 1);
+
+    unlock_tag_stripes(stripes, count);
+    return wilderness;
+}
+
+/*
+    Returns an allocated block of size_align bytes, growing the heap if no free block fits.
+    Threads that miss at the same time queue on sf_grow_lock and search again before growing,
+    so a burst of misses grows the heap once rather than once per thread.  Each growth adds all
+    the pages the block needs (see heap_growth_pages).
+*/
+sf_block *allocate_block_locked(size_t size_align) {
+    return allocate_aligned_block_locked(size_align, MIN_BLOCK_SIZE);
+}
+
+sf_block *allocate_aligned_block_locked(size_t size_align, size_t align) {
+    if (!check_initialized_heap()) return NULL;
+
+    sf_block *block = take_aligned_free_block_locked(size_align, align);
+    if (block != NULL) return block;
+
+    // Merging the blocks deferred on the quick lists may make room without growing the heap
+    if (quick_consolidate() && (block = take_aligned_free_block_locked(size_align, align)) != NULL) return block;
+
+    pthread_mutex_lock(&sf_grow_lock);
+    while ((block = take_aligned_free_block_locked(size_align, align)) == NULL) {
+        if (grow_heap_locked(heap_growth_pages(aligned_fit_size(size_align, align))) == NULL) {
+            pthread_mutex_unlock(&sf_grow_lock);
+            sf_errno = ENOMEM;
+            return NULL;
+        }
+    }
+    pthread_mutex_unlock(&sf_grow_lock);
+
+    return block;
+}
+
+/*
+    Grows a block owned by the caller in place to size_align bytes by absorbing the free block
+    after it, growing the heap first when the block is at the end of the heap.  The block after the
+    absorbed one is found from the absorbed block's header without holding its stripe, so the three
+    stripes are locked in order and the header is checked again before anything is changed.
+    Returns 1 if the block was grown, 0 if it has to be moved.
+*/
+int extend_block_locked(sf_block *block, size_t size_align) {
+    size_t block_size = get_block_size(block); // the caller owns the block, so its size can't change
+    sf_block *next_block = get_block_end(block);
+    int grown = 0;
+
+    while (1) {
+        lock_block_tags(next_block);
+        size_t next_header_seen = next_block->header & ~(sf_header)(PREV_BLOCK_ALLOC | CACHED_BLOCK);
+        unlock_block_tags(next_block);
+
+        int next_free = !(next_header_seen & CURR_BLOCK_ALLOC);
+        sf_block *after_next = next_free ? (sf_block *)((char *)next_block + (next_header_seen & ~0x1F)) : next_block;
+
+        int stripes[3] = {tag_lock_index(block), tag_lock_index(next_block), tag_lock_index(after_next)};
+        int count = lock_tag_stripes(stripes, 3);
+
+        if ((next_block->header & ~(sf_header)(PREV_BLOCK_ALLOC | CACHED_BLOCK)) != next_header_seen) {
+            unlock_tag_stripes(stripes, count); // the next block was allocated, freed or merged meanwhile
+            continue;
+        }
+
+        size_t available = block_size;
+        if (next_free) available += get_block_size(next_block);
+
+        if (available >= size_align) {
+            // Free memory split off the next block is out of sight until the remainder is released
+            int split_off = next_free && available - size_align >= MIN_BLOCK_SIZE;
+            int window = split_off ? open_release_window() : -1;
+            if (next_free) {
+                unlink_free_block_locked(next_block);
+                set_prev_alloc_bit(after_next, 1); // its old footer is about to be inside this block
+            }
+
+            int prev_bit = 0;
+            if (get_prev_alloc_bit(block)) {
+                // means previous bit is allocated set to 1
+                prev_bit = 1;
+            }
+
+            // As in take_free_block_locked, the remainder stays marked allocated until it is released
+            sf_block *remainder = NULL;
+            if (available - size_align >= MIN_BLOCK_SIZE) {
+                write_block_header(block, size_align, prev_bit, 1);
+                remainder = get_block_end(block);
+                write_claimed_block_header(remainder, available - size_align, 1);
+                SF_STAT_ADD(splits, 1);
+            } else {
+                write_block_header(block, available, prev_bit, 1);
+            }
+            unlock_tag_stripes(stripes, count);
+
+            if (remainder != NULL) release_block_locked(remainder);
+            if (window >= 0) close_release_window(window);
+            return 1;
+        }
+
+        // The epilogue is the only block of size 0
+        int at_heap_end = get_block_size(next_block) == 0 || (next_free && get_block_size(after_next) == 0);
+        unlock_tag_stripes(stripes, count);
+        if (!at_heap_end || grown) return 0;
+
+        pthread_mutex_lock(&sf_grow_lock);
+        sf_block *more_memory = grow_heap_locked(growth_pages_with_ramp(size_align - available));
+        pthread_mutex_unlock(&sf_grow_lock);
+        if (more_memory == NULL) return 0;
+        grown = 1;
+    }
+}
+
+/*
+    Shrinks a block owned by the caller to size_align bytes and releases the tail.
+    The tail must be at least MIN_BLOCK_SIZE bytes.
+*/
+void shrink_block_locked(sf_block *block, size_t size_align) {
+    lock_block_tags(block);
+    size_t block_size = get_block_size(block);
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    write_block_header(block, size_align, prev_bit, 1);
+
+    sf_block *tail = get_block_end(block);
+    write_claimed_block_header(tail, block_size - size_align, 1);
+    unlock_block_tags(block);
+
+    release_block_locked(tail);
+}
+
+/*
+    fork() copies only the calling thread, so a lock some other thread held at that moment stays
+    locked in the child forever.  lock_heap_for_fork takes every lock of the heap, in the order
+    above with the slab locks first and the quick list and profile locks last, so no other thread
+    is halfway through changing the heap when it is copied; unlock_heap_after_fork releases them
+    again in the parent and in the child.  Arena locks are not taken.
+*/
+void lock_heap_for_fork(void) {
+    slab_fork_locks(1);
+    pthread_mutex_lock(&sf_grow_lock);
+    for (int i = 0; i < TAG_LOCK_STRIPES; i++) pthread_mutex_lock(&tag_locks[i]);
+    for (int i = 0; i < MAX_FREE_LISTS; i++) pthread_mutex_lock(&sf_free_list_locks[i]);
+    quick_fork_lock(1);
+    profile_fork_lock(1);
+}
+
+void unlock_heap_after_fork(void) {
+    profile_fork_lock(0);
+    quick_fork_lock(0);
+    for (int i = MAX_FREE_LISTS - 1; i >= 0; i--) pthread_mutex_unlock(&sf_free_list_locks[i]);
+    for (int i = TAG_LOCK_STRIPES - 1; i >= 0; i--) pthread_mutex_unlock(&tag_locks[i]);
+    pthread_mutex_unlock(&sf_grow_lock);
+    slab_fork_locks(0);
+}
+
+#endif
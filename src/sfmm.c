@@ -15,6 +15,23 @@
 
 #include "test_header.h"
 
+#ifdef SF_THREADS
+static int heap_initialized; // set once the prologue, first block and free lists are in place
+#endif
+int sf_tcache_enabled = 0; // opt in with SF_OPT_TCACHE, so block layouts are the same in every build
+size_t sf_tcache_count = TCACHE_DEFAULT_COUNT;
+int sf_slab_enabled = 0;
+size_t sf_free_check_interval = FREE_CHECK_DEFAULT_INTERVAL;
+size_t sf_realloc_slack; // bytes a shrinking realloc leaves in the block instead of splitting them off
+uint64_t sf_free_list_bitmap; // bit i is set while free list i is not empty
+sf_block *sf_large_block_root; // tree of the blocks on the last free list (see sftree.c)
+sf_list_set sf_default_lists = {sf_free_list_heads, &sf_free_list_bitmap, &sf_large_block_root};
+sf_block sf_extended_free_list_heads[MAX_FREE_LISTS]; // the default heap's lists when there are more than NUM_FREE_LISTS
+int sf_size_class_scheme = SF_DEFAULT_SIZE_CLASSES;
+int sf_num_free_lists = NUM_FREE_LISTS; // set from the scheme by build_size_class_table
+size_t sf_grow_max_pages = GROW_DEFAULT_MAX_PAGES;
+static size_t grow_chunk_pages = 1; // pages the next heap growth adds at least, doubles up to sf_grow_max_pages
+
 size_t align_size(size_t size) {
     size_t size_plus_header = size + sizeof(sf_header);
     size_t aligned_size = (size_plus_header+ MIN_BLOCK_SIZE - 1) & ~(MIN_BLOCK_SIZE - 1);
@@ -33,6 +50,15 @@ int set_block_size(sf_block *block, size_t size) {
 }
 
 int set_prev_alloc_bit(sf_block *block, int flag) {
+#ifdef SF_THREADS
+    // The owner of a cached block flips CACHED_BLOCK without holding the stripe, so both bit updates are atomic
+    if (flag != 0) {
+        __atomic_fetch_or(&block->header, PREV_BLOCK_ALLOC, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&block->header, ~(sf_header)PREV_BLOCK_ALLOC, __ATOMIC_RELAXED);
+    }
+    return 0;
+#endif
     if (flag != 0) {
         block->header |= PREV_BLOCK_ALLOC;
     } else { // prev alloc is 0
@@ -56,6 +82,41 @@ int get_curr_alloc_bit(sf_block *block) {
     return (block->header & CURR_BLOCK_ALLOC);
 }
 
+int set_sampled_bit(sf_block *block, int flag) {
+#ifdef SF_THREADS
+    // A neighbor may be flipping the prev alloc bit of this header at the same time
+    if (flag != 0) {
+        __atomic_fetch_or(&block->header, SAMPLED_BLOCK, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&block->header, ~(sf_header)SAMPLED_BLOCK, __ATOMIC_RELAXED);
+    }
+    return 0;
+#endif
+    if (flag != 0) {
+        block->header |= SAMPLED_BLOCK;
+    } else { // not sampled
+        block->header &= ~SAMPLED_BLOCK;
+    }
+    return 0;
+}
+
+int set_cached_bit(sf_block *block, int flag) {
+#ifdef SF_THREADS
+    if (flag != 0) {
+        __atomic_fetch_or(&block->header, CACHED_BLOCK, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&block->header, ~(sf_header)CACHED_BLOCK, __ATOMIC_RELAXED);
+    }
+    return 0;
+#endif
+    if (flag != 0) {
+        block->header |= CACHED_BLOCK;
+    } else { // not cached
+        block->header &= ~CACHED_BLOCK;
+    }
+    return 0;
+}
+
 sf_block *get_block_end(sf_block *block) {
     return (sf_block *)((void *)block + get_block_size(block));
 }
@@ -89,6 +150,24 @@ sf_block *write_block_header(sf_block *block, size_t size, int prev_alloc, int a
         write_footer_only_free_blocks(block);
     }
 
+    // An allocated block past the zero watermark is about to be written to (see sfcalloc.c)
+    if (alloc == 1 && (char *)block + size > __atomic_load_n(&sf_zero_watermark, __ATOMIC_RELAXED)) {
+        zero_watermark_raise(block, size);
+    }
+
+    return block;
+}
+
+/*
+    write_block_header for a block that is marked allocated without being handed out, like the
+    wilderness while it is claimed for a trim, the pages a growth adds before they are freed or the
+    part a split cuts off before it is released.  Nothing writes to such a block, so the zero
+    watermark stays where it is.
+*/
+sf_block *write_claimed_block_header(sf_block *block, size_t size, int prev_alloc) {
+    block->header = size;
+    set_curr_alloc_bit(block, 1);
+    set_prev_alloc_bit(block, prev_alloc);
     return block;
 }
 
@@ -96,9 +175,8 @@ sf_block *write_block_header(sf_block *block, size_t size, int prev_alloc, int a
     THIS FUNCTION IS STRICTLY FOR ACCESSING AN EXACT MATCH IN THE FREE LIST TRAVERSAL
     THEREFORE IT RETURNS THE EXACT MATCH BLOCK THAT IT HAS FOUND
     Return the Block: The function returns the block, which is essential for using it to satisfy a memory allocation request.
-    Handling Circular List: If the block is the only one in the free list, the sentinel node is reset to point to itself, keeping the list circular.
-    Unlinking the Block: The block is unlinked from the list by updating the next and prev pointers of neighboring blocks.
-    Clearing Links: After unlinking, the block’s next and prev pointers are set to NULL to indicate that it's no longer part of any list, making it ready for allocation.
+    Unlinking the Block: The block is unlinked with remove_from_free_list, which keeps the list circular, clears the block's links
+    and updates the non-empty list bitmap.
 */
 sf_block *unlink_block_from_free_list_return_malloc_request(sf_block *block) {
 
@@ -110,97 +188,112 @@ sf_block *unlink_block_from_free_list_return_malloc_request(sf_block *block) {
         return NULL; // Block is either allocated or pointers are invalid, return NULL
     }
 
-    // 2. Get the next and previous blocks in the free list
-    sf_block *next_block = block->body.links.next;
-    sf_block *prev_block = block->body.links.prev;
-
-    // 3. Handle the case where the block is the only one in the list (circular list)
-    if (next_block == block && prev_block == block) {
-        // This is the only block in the list, reset the sentinel to point to itself
-        // This is the only block in the list, reset the sentinel to point to itself
-        // Access the sentinel node directly using the known structure
-        sf_block *sentinel = &sf_free_list_heads[(block->header & ~0x1F) >> 5]; // Example size class calculation
-        sentinel->body.links.next = sentinel;
-        sentinel->body.links.prev = sentinel;
-    } else {
-    // 4. Relink the previous and next blocks to bypass the current block
-        prev_block->body.links.next = next_block;
-        next_block->body.links.prev = prev_block;
-    }
+    // 2. Unlink the block, clearing its links so it's no longer part of any list
+    remove_from_free_list(block);
 
-    // 5. Clear the block's links to indicate it's no longer in the free list
-    block->body.links.next = NULL;
-    block->body.links.prev = NULL;
-
-    // 6. Return the unlinked block, ready to be allocated
+    // 3. Return the unlinked block, ready to be allocated
     return block;
 }
 
 void initialize_free_lists(int index) {
 // Base case: If initialized all free lists, stop recursion.
-    if (index >= NUM_FREE_LISTS) {
+    if (index >= sf_num_free_lists) {
         return;
     }
 // Initialize the current sentinel to point to itself.
-    sf_free_list_heads[index].body.links.next = &sf_free_list_heads[index];
-    sf_free_list_heads[index].body.links.prev = &sf_free_list_heads[index];
+    sf_block *free_list_head = &sf_default_lists.heads[index];
+    free_list_head->body.links.next = free_list_head;
+    free_list_head->body.links.prev = free_list_head;
+    sf_free_list_bitmap &= ~FREE_LIST_BIT(index);
+    if (index == LAST_FREE_LIST) sf_large_block_root = NULL;
 // Recurse to initialize the next sentinel.
     initialize_free_lists(index + 1);
 }
 
-int get_free_list_index(size_t size) {
-// Define Fibonacci-based size classes for the free lists
-    size_t fib_sizes[NUM_FREE_LISTS] = {MIN_BLOCK_SIZE, 2 * MIN_BLOCK_SIZE, 3 * MIN_BLOCK_SIZE,
-    5 * MIN_BLOCK_SIZE, 8 * MIN_BLOCK_SIZE, 13 * MIN_BLOCK_SIZE,
-    21 * MIN_BLOCK_SIZE, 34 * MIN_BLOCK_SIZE};
-
-// Iterate through the size classes and return the corresponding index
-    for (int index = 0; index < NUM_FREE_LISTS - 1; index++) {
-        if (size <= fib_sizes[index]) {
-            return index;
+/*
+    Size class lookup shared by every path that needs a free list index.
+
+    Every list but the last holds the blocks up to its bound, measured in MIN_BLOCK_SIZE units (M), and the
+    last list holds everything larger than the bound of the list before it.  The bounds depend on
+    sf_size_class_scheme (see SF_OPT_SIZE_CLASSES):
+
+        SF_CLASSES_FIBONACCI     1M, 2M, 3M, 5M, 8M, ... 34M                    9 lists, the sfmm.h layout
+        SF_CLASSES_POWER_OF_TWO  1M, 2M, 4M, 8M, ... 32768M (1MB)               17 lists
+        SF_CLASSES_QUARTER       1M, 2M, 3M, 4M, 5M, 6M, 7M, 8M, 10M, 12M, ...  57 lists, 4 per power of two
+
+    Instead of searching the bounds on every call, build_size_class_table computes them once (when the
+    heap is set up) and records the list of every size up to SIZE_CLASS_TABLE_UNITS in a table, so a
+    lookup is a shift, a compare and a load.  Only the schemes whose bounds go past the table binary
+    search them for larger sizes.
+*/
+static unsigned char size_class_by_units[SIZE_CLASS_TABLE_UNITS + 1];
+static size_t size_class_limit_units; // largest size the table covers, in units
+static size_t size_class_bounds[MAX_FREE_LISTS - 1]; // bound of every list but the last, in units
+
+static int build_size_class_bounds(void) {
+    int classes = 0;
+
+    if (sf_size_class_scheme == SF_CLASSES_POWER_OF_TWO) {
+        for (size_t bound = 1; bound <= SIZE_CLASS_MAX_UNITS; bound *= 2) {
+            size_class_bounds[classes++] = bound;
+        }
+    } else if (sf_size_class_scheme == SF_CLASSES_QUARTER) {
+        for (size_t bound = 1; bound <= 4; bound++) {
+            size_class_bounds[classes++] = bound;
+        }
+        for (size_t power = 4; power < SIZE_CLASS_MAX_UNITS; power *= 2) {
+            for (size_t step = 1; step <= 4; step++) {
+                size_class_bounds[classes++] = power + step * (power / 4); // quarter steps up to the next power
+            }
+        }
+    } else {
+        size_t bound = 1, next_bound = 2; // Fibonacci bounds of the current and next list, in units
+        while (classes < NUM_FREE_LISTS - 1) {
+            size_class_bounds[classes++] = bound;
+            size_t following_bound = bound + next_bound;
+            bound = next_bound;
+            next_bound = following_bound;
         }
     }
-
-// If the size is larger than the largest Fibonacci class, return the last index
-    return NUM_FREE_LISTS - 1;
+    return classes;
 }
 
-sf_block *get_free_list_head_to_search_for_block(size_t size) {
-    // THIS FUNCTION IS FOR FINDING THE HEAD OF EACH FREE LIST, AND RETURNING THE HEAD OF THE FREE LIST THAT SHOULD BE SEARCHED
-    // IT RETURNS THE HEAD OF THE FREE LIST THAT IS LIKELY TO CONTAIN THE CORRECT SIZE BLOCKS TO SATISFY THE REQUESTS
-
-    // Define Fibonacci-based size classes for the free lists
-    size_t fib_sizes[NUM_FREE_LISTS] = {MIN_BLOCK_SIZE, 2 * MIN_BLOCK_SIZE, 3 * MIN_BLOCK_SIZE,
-    5 * MIN_BLOCK_SIZE, 8 * MIN_BLOCK_SIZE, 13 * MIN_BLOCK_SIZE,
-    21 * MIN_BLOCK_SIZE, 34 * MIN_BLOCK_SIZE};
+void build_size_class_table() {
+    int classes = build_size_class_bounds();
+    sf_num_free_lists = classes + 1;
+    sf_default_lists.heads = (sf_num_free_lists > NUM_FREE_LISTS) ? sf_extended_free_list_heads : sf_free_list_heads;
 
-    // Iterate through the size classes and return the corresponding index
-    for (int index = 0; index < NUM_FREE_LISTS - 1; index++) {
-        if (size <= fib_sizes[index]) {
-            return &sf_free_list_heads[index];
+    size_t units = 0;
+    for (int index = 0; index < classes; index++) {
+        while (units <= size_class_bounds[index] && units <= SIZE_CLASS_TABLE_UNITS) {
+            size_class_by_units[units++] = index;
         }
     }
 
-    // If the size is larger than the largest Fibonacci class, return the last index
-    return &sf_free_list_heads[NUM_FREE_LISTS - 1];
+    // Bounds that don't fit in the table are clamped, so larger sizes are looked up in size_class_bounds
+    size_class_limit_units = units - 1;
 }
 
-sf_block *find_and_remove_exact_match_free_list_block(sf_block *free_list_head_pntr, size_t size) {
-    // THIS IS FOR FINDING THE EXACT MATCH OF A BLOCK IN A FREE LIST: CASE 1 - BEST CASE WHICH IS EXACT MATCH
+int get_free_list_index(size_t size) {
+    size_t units = (size + MIN_BLOCK_SIZE - 1) / MIN_BLOCK_SIZE;
 
-    sf_block *free_list_iteration = free_list_head_pntr->body.links.next;
+    if (units <= size_class_limit_units) return size_class_by_units[units];
+    if (units > size_class_bounds[LAST_FREE_LIST - 1]) return LAST_FREE_LIST;
 
-    // Traverse the circular doubly linked list
-    while (free_list_iteration != free_list_head_pntr) {
-        if (get_block_size(free_list_iteration) == size) {
-            free_list_iteration = unlink_block_from_free_list_return_malloc_request(free_list_iteration); // IF AN EXACT MATCH IS FOUND IT IS UNLINKED AND RETURNED
-            return free_list_iteration; // Return the block found and removed
-        }
-        free_list_iteration = free_list_iteration->body.links.next; // Move to the next block
+    // First bound that is not below units, among the lists the table doesn't reach
+    int low = size_class_by_units[size_class_limit_units], high = LAST_FREE_LIST - 1;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (size_class_bounds[middle] < units) low = middle + 1;
+        else high = middle;
     }
+    return low;
+}
 
-    // No block of the desired size was found
-    return NULL;
+sf_block *get_free_list_head_to_search_for_block(size_t size) {
+    // THIS FUNCTION IS FOR FINDING THE HEAD OF EACH FREE LIST, AND RETURNING THE HEAD OF THE FREE LIST THAT SHOULD BE SEARCHED
+    // IT RETURNS THE HEAD OF THE FREE LIST THAT IS LIKELY TO CONTAIN THE CORRECT SIZE BLOCKS TO SATISFY THE REQUESTS
+    return &sf_default_lists.heads[get_free_list_index(size)];
 }
 
 /*
@@ -232,7 +325,7 @@ sf_block *coalesce_next(sf_block *block) {
         set_prev_alloc_bit(next_block, 0); // there is the current block, before the next one that has been checked to be not allocated
     }
 
-    // Unlink the previous block from the free list
+    // Unlink the next block from the free list
     // Removing the block from the free list
     if (get_curr_alloc_bit(next_block)) { // curr bit is 1
         return NULL;
@@ -243,10 +336,7 @@ sf_block *coalesce_next(sf_block *block) {
     if (next_block->body.links.prev == NULL) {
         return NULL;
     }
-    sf_block *next = next_block->body.links.next;
-    sf_block *prev = next_block->body.links.prev;
-    next->body.links.prev = prev;
-    prev->body.links.next = next;
+    remove_from_free_list(next_block);
 
     // Ensure the next block can be coalesced (it should not be allocated)
     if (get_prev_alloc_bit(next_block)|| get_curr_alloc_bit(next_block)) {
@@ -265,12 +355,13 @@ sf_block *coalesce_next(sf_block *block) {
     // Write header with size and allocation flags
     write_block_header(block, new_size, prev_bit, 0);
 
-    sf_block *next_free_block = next_block->body.links.next;
-    sf_block *prev_free_block = next_block->body.links.prev;
+    sf_block *next_free_block = NULL;
+    sf_block *prev_free_block = NULL;
     // Set next and previous links for free block
     block->body.links.next = next_free_block;
     block->body.links.prev = prev_free_block;
 
+    SF_STAT_ADD(coalesces, 1);
     return block; // Return the coalesced block
 }
 
@@ -328,12 +419,7 @@ sf_block *coalesce_prev(sf_block *block) {
         return NULL;
     }
 
-    sf_block *next = prev_block->body.links.next;
-    sf_block *prev = prev_block->body.links.prev;
-    next->body.links.prev = prev;
-    prev->body.links.next = next;
-    prev_block->body.links.next = NULL;
-    prev_block->body.links.prev = NULL;
+    remove_from_free_list(prev_block);
 
     // Combine the two blocks
     size_t new_size = get_block_size(prev_block) + get_block_size(block);
@@ -353,6 +439,7 @@ sf_block *coalesce_prev(sf_block *block) {
     prev_block->body.links.next = next_free_block;
     prev_block->body.links.prev = prev_free_block;
 
+    SF_STAT_ADD(coalesces, 1);
     return prev_block; // Return the coalesced block
 }
 
@@ -392,16 +479,45 @@ sf_block *coalesce_if_possible(sf_block *block) {
     return (coalesced_block != NULL) ? coalesced_block : block;
 }
 
+/*
+    sf_free_list_bitmap has bit i set while free list i is not empty, so a search can jump straight to the first
+    non-empty list with find-first-set instead of walking every sentinel.  Lists of different size classes are
+    changed under different locks in SF_THREADS builds, so there the bits are updated atomically.
+*/
+void set_free_list_bit(sf_list_set *lists, int index) {
+#ifdef SF_THREADS
+    __atomic_fetch_or(lists->bitmap, FREE_LIST_BIT(index), __ATOMIC_RELAXED);
+    return;
+#endif
+    *lists->bitmap |= FREE_LIST_BIT(index);
+}
+
+void clear_free_list_bit(sf_list_set *lists, int index) {
+#ifdef SF_THREADS
+    __atomic_fetch_and(lists->bitmap, ~FREE_LIST_BIT(index), __ATOMIC_RELAXED);
+    return;
+#endif
+    *lists->bitmap &= ~FREE_LIST_BIT(index);
+}
+
 /*
     The assignment specifies that free lists should be managed using a last-in, first-out (LIFO) discipline. 
     This means that newly freed blocks should be inserted at the front of the corresponding free list
     Helper function to insert a block into the free list using LIFO discipline
 */
 void insert_block_to_free_list(sf_block *block) {
+    insert_block_to_lists(&sf_default_lists, block);
+}
+
+/*
+    insert_block_to_free_list for any set of free lists, the default heap's or an arena's.
+*/
+void insert_block_to_lists(sf_list_set *lists, sf_block *block) {
     // Get the size of the block and find the appropriate free list
     size_t block_size = get_block_size(block);
+    int index = get_free_list_index(block_size);
 
-    sf_block *free_list_head = get_free_list_head_to_search_for_block(block_size);
+    sf_block *free_list_head = &lists->heads[index];
 
     // Insert the block at the front of the free list
     sf_block *next = free_list_head->body.links.next;
@@ -410,6 +526,11 @@ void insert_block_to_free_list(sf_block *block) {
     block->body.links.prev = next->body.links.prev;
     next->body.links.prev->body.links.next = block;
     next->body.links.prev = block;
+
+    // Blocks of the last list are also indexed by (size, address) for best fit
+    if (index == LAST_FREE_LIST) tree_insert(lists->large_root, block);
+
+    set_free_list_bit(lists, index);
 }
 
 /*
@@ -468,6 +589,7 @@ sf_block *split_free_block(sf_block *free_block_part_remaining_put_back, sf_bloc
         if (new_free_block != NULL) {
             add_block_free_list_LIFO(new_free_block);
         }
+        SF_STAT_ADD(splits, 1);
     }
 
     return allocated_block_to_return; // No free block to return if the remaining size was too small
@@ -487,12 +609,28 @@ sf_block *split_free_block(sf_block *free_block_part_remaining_put_back, sf_bloc
     Nullify Pointers:
     After the block is removed, the block's next and prev pointers are set to NULL to signify that it's no longer part of the list.
 
+    Bitmap:
+    If the block was the last one in its list, the list's bit in sf_free_list_bitmap is cleared.
+
     The function only modifies the pointers in the list and doesn't need to return anything. 
     It ensures the list is correctly maintained by unlinking the block from the free list.
 */
 void remove_from_free_list(sf_block *block) {
-    block->body.links.prev->body.links.next = block->body.links.next;
-    block->body.links.next->body.links.prev = block->body.links.prev;
+    remove_block_from_lists(&sf_default_lists, block);
+}
+
+void remove_block_from_lists(sf_list_set *lists, sf_block *block) {
+    if (get_free_list_index(get_block_size(block)) == LAST_FREE_LIST) tree_remove(lists->large_root, block);
+
+    sf_block *next = block->body.links.next;
+    sf_block *prev = block->body.links.prev;
+    prev->body.links.next = next;
+    next->body.links.prev = prev;
+
+    // Only a sentinel links to itself, and when it does its list is now empty
+    if (next == prev && next->body.links.next == next) {
+        clear_free_list_bit(lists, next - lists->heads);
+    }
 
     // Set the block's next and prev pointers to NULL to signify it's removed
     block->body.links.next = NULL;
@@ -511,92 +649,68 @@ sf_block *allocate_block_with_split_from_free(sf_block *split_part_satisfy_mallo
     return split_part_satisfy_malloc_request; // Return the allocated block
 }
 
-// Helper function to allocate a block when no split can be made without creating a splinter
-sf_block *allocate_block_waste_space(sf_block *free_block_to_return, size_t size) {
-    // Remove the block from the free list
-    remove_from_free_list(free_block_to_return);
-
-    int prev_bit = 0;
-    if (get_prev_alloc_bit(free_block_to_return)) {
-        // means previous bit is allocated set to 1
-        prev_bit = 1;
+void *padding(void *startAddr) {
+    // Adjust for 32-byte alignment (either 8 or 24 padding)
+    if ((((uintptr_t)startAddr) & 0x1F) != 0) {
+        startAddr += 8;
+    } else {
+        startAddr += 24;
     }
-
-    // Write header for the allocated block
-    write_block_header(free_block_to_return, size, prev_bit, 1);
-
-    return free_block_to_return;
+    return startAddr;
 }
 
 /*
-    THIS IS STRICTLY FOR FINDING A BLOCK THAT IS AT LEAST AS BIG AS THE MALLOC REQUEST SIZE: CASE 3
-    This is where no block is big enough to split and not create a splinter (where the remaining piece is still greater than minimum block size 32)
-    Therefore, before the absolute worst case (where we have to grow the heap and add more pages of memory) it just looks for a block that is big enough
-    There will be fragmentation and wasted space at the "end of the block" where it is not used for the allocation request, but can't be split away
+    Works out how many pages the heap has to grow by so a block of size_align bytes fits.
+    If the block before the epilogue is free (the wilderness) it is coalesced with the new memory,
+    so only the part of the request it can't cover has to be added.
 
-    Iterate through all free lists but since can't split without making splinter
-    Instead just find a block that is at least as big, and use without splitting ust waste the space
+    Back to back growths mean the program keeps running out of memory, so each growth makes the
+    next one at least twice as big (up to sf_grow_max_pages) instead of paying for one page at a time.
 */
-sf_block *find_and_allocate_block_no_split_waste_space(int free_list_index_matched, size_t size) {
-    for (int current_list = free_list_index_matched; current_list < NUM_FREE_LISTS; current_list++) {
-        sf_block *pntr_free_list_head = &sf_free_list_heads[current_list];
-        sf_block *access_free_list = pntr_free_list_head->body.links.next;
-
-        // Traverse the free list to find a suitable block
-        while (access_free_list != pntr_free_list_head) {
-            // Check if the block is large enough
-            if (get_block_size(access_free_list) >= size) {
-                return allocate_block_waste_space(access_free_list, size);
-            }
-            access_free_list = access_free_list->body.links.next; // Move to the next block
-        }
-    }
+size_t growth_pages_with_ramp(size_t missing) {
+    size_t page_size = heap_page_size();
+    size_t pages = (missing + page_size - 1) / page_size;
+    if (pages < grow_chunk_pages) pages = grow_chunk_pages;
 
-    return NULL; // No suitable block found
-}
+    grow_chunk_pages *= 2;
+    if (grow_chunk_pages > sf_grow_max_pages) grow_chunk_pages = sf_grow_max_pages;
 
-/*
-    THIS IS STRICTLY FOR FINDING A BLOCK THAT IS BIG ENOUGH TO SPLIT SO ONE PIECE SATISFIES THE MALLOC REQUEST AND THE OTHER IS > 32
-    SPLITS BLOCK TO COVER MALLOC REQUEST WITHOUT CREATING A SPLINTER
-*/
-sf_block *find_and_allocate_block_split_no_splinter(int free_list_index_matched, size_t size) {
-    // Iterate through all free lists and try and split with no splinter
-    // the requested size >= 32 is matched to a block, and that block is split where the splitted piece is also >= 32
-    for (int current_list = free_list_index_matched; current_list < NUM_FREE_LISTS; current_list++) {
-        sf_block *pntr_free_list_head = &sf_free_list_heads[current_list];
-        sf_block *access_free_list = pntr_free_list_head->body.links.next;
-
-        // Traverse the free list to find a suitable block
-        while (access_free_list != pntr_free_list_head) {
-            // Check if the block is large enough
-            if (get_block_size(access_free_list) >= size) { // size is already passed as parameter with + 32 so already accounting for split
-                sf_block *split_part_satisfy_malloc_request = pntr_free_list_head->body.links.next;
-                // Allocate the block
-                return allocate_block_with_split_from_free(split_part_satisfy_malloc_request, access_free_list, size);
-            }
-            access_free_list = access_free_list->body.links.next; // Move to the next block
-        }
-    }
-    return NULL; // No suitable block found
+    return pages;
 }
 
-void *padding(void *startAddr) {
-    // Adjust for 32-byte alignment (either 8 or 24 padding)
-    if ((((uintptr_t)startAddr) & 0x1F) != 0) {
-        startAddr += 8;
-    } else {
-        startAddr += 24;
+size_t heap_growth_pages(size_t size_align) {
+    sf_block *epilogue = heap_mem_end() - EPILOGUE_SIZE;
+    size_t wilderness_size = 0;
+
+#ifdef SF_THREADS
+    int stripes[3];
+    int count;
+    sf_block *wilderness = lock_block_neighbors(epilogue, stripes, &count);
+    if (wilderness != NULL) wilderness_size = get_block_size(wilderness);
+    unlock_tag_stripes(stripes, count);
+#else
+    if (!get_prev_alloc_bit(epilogue)) {
+        sf_footer *wilderness_footer = (sf_footer *)((char *)epilogue - sizeof(sf_footer));
+        wilderness_size = *wilderness_footer & ~0x1F;
     }
-    return startAddr;
+#endif
+
+    size_t missing = (size_align > wilderness_size) ? size_align - wilderness_size : 0;
+    return growth_pages_with_ramp(missing);
 }
 
 /*
     Get more memory for the heap
-    Turn it into a new block (set size so space for epilogue)
+    Grow by up to npages pages, stopping early if the page provider runs out of memory
+    Turn everything that was added into one new block (set size so space for epilogue)
     Insert the new block into the heap (would be combined by coalesce together)
+    Returns NULL with sf_errno set to ENOMEM only if not a single page could be added
+    While a region is held the heap only grows for the region, so NULL is returned right away
 */
-sf_block *grow_heap() {
-    sf_block *original_epilogue = sf_mem_end() - sizeof(sf_footer); // this will be overwritten and made into the new header
+sf_block *grow_heap(size_t npages) {
+    if (region_is_active()) return NULL; // the memory behind the epilogue is kept for the region (callers set sf_errno)
+
+    sf_block *original_epilogue = heap_mem_end() - sizeof(sf_footer); // this will be overwritten and made into the new header
     int prev_bit = 0;
     if (get_prev_alloc_bit(original_epilogue)) {
         // means previous bit is allocated set to 1
@@ -604,19 +718,24 @@ sf_block *grow_heap() {
     }
 
     sf_block *new_mem_block = original_epilogue; // create the new block of memory right where the old memory used to end
-    void *old_memory_end = sf_mem_end();
+    void *old_memory_end = heap_mem_end();
 
-    void *heap_grow = sf_mem_grow(); // grow the heap by one page
-    if (heap_grow == NULL) {
+    size_t pages_grown = 0;
+    while (pages_grown < npages && heap_mem_grow() != NULL) { // grow the heap one page at a time, all before writing any block
+        pages_grown++;
+    }
+    if (pages_grown == 0) {
         sf_errno = ENOMEM;
         //fprintf(stderr, "ERROR: growing the heap, sf_errno set\n");
         return NULL;
     }
+    stat_record_heap_growth();
+    zero_watermark_grown(old_memory_end);
 
-    void *new_epilogue = sf_mem_end() - EPILOGUE_SIZE; // set up the new epilogue repositioned at the end of the heap
+    void *new_epilogue = heap_mem_end() - EPILOGUE_SIZE; // set up the new epilogue repositioned at the end of the heap
     write_block_header(new_epilogue, 0, 0, 1); // write the epilogue information
 
-    int mem_size = sf_mem_end() - old_memory_end; // set up the new block of memory
+    int mem_size = heap_mem_end() - old_memory_end; // set up the new block of memory
     write_block_header(original_epilogue, mem_size, prev_bit, 0);
     original_epilogue->body.links.next = 0;
     original_epilogue->body.links.prev = 0;
@@ -634,45 +753,66 @@ sf_block *grow_heap() {
 }
 
 /*
-    THIS IS THE MAIN DRIVER CODE OF LOGIC THAT TRAVERSES THE FREE LIST AND LOOKS FOR A BLOCK
+    THIS IS THE MAIN DRIVER CODE OF LOGIC THAT LOOKS THROUGH THE FREE LISTS FOR A BLOCK
+
+    1. One pass over the list the size maps to: an exact match is taken right away (best case, no split),
+       otherwise the first block that can be split without leaving a splinter is remembered.
+    2. If that list had nothing to split, every block in a higher list is bigger than this list's largest
+       size, and sizes are multiples of 32, so any of them can be split.  find-first-set on the bitmap
+       gives the first non-empty higher list without looking at the empty ones.
+    The last list is never scanned: its tree gives the best fit (the smallest block that is big enough,
+    lowest address first) directly, both when the size maps to it and when it is the higher list picked.
 */
 sf_block *get_free_list_block(size_t size) {
-    sf_block *free_list_head_pntr = get_free_list_head_to_search_for_block(size);
-    if (free_list_head_pntr == NULL) {
-        initialize_free_lists(0);
-        return NULL;
-    }
+    int free_list_index_matched = get_free_list_index(size);
+    sf_block *free_list_head_pntr = &sf_default_lists.heads[free_list_index_matched];
+    sf_block *block_to_split = NULL;
 
-    sf_block *free_list_iteration = find_and_remove_exact_match_free_list_block(free_list_head_pntr, size);
-    if (free_list_iteration != NULL) {
-        return free_list_iteration;
-    }
+    // Large blocks are searched through their tree, which finds the best fit without a scan
+    if (free_list_index_matched == LAST_FREE_LIST) {
+        block_to_split = tree_best_fit(sf_large_block_root, size);
+        if (block_to_split == NULL) return NULL;
+        if (get_block_size(block_to_split) == size) return unlink_block_from_free_list_return_malloc_request(block_to_split);
 
-    int free_list_index_matched = get_free_list_index(size + MIN_BLOCK_SIZE);
+        return allocate_block_with_split_from_free(block_to_split, block_to_split, size + MIN_BLOCK_SIZE);
+    }
 
-    sf_block *satisfying_block_with_split = find_and_allocate_block_split_no_splinter(free_list_index_matched, size + MIN_BLOCK_SIZE);
-    if (satisfying_block_with_split != NULL) {
-        return satisfying_block_with_split;
+    if (sf_free_list_bitmap & FREE_LIST_BIT(free_list_index_matched)) {
+        sf_block *free_list_iteration = free_list_head_pntr->body.links.next;
+        while (free_list_iteration != free_list_head_pntr) {
+            size_t block_size = get_block_size(free_list_iteration);
+            if (block_size == size) {
+                return unlink_block_from_free_list_return_malloc_request(free_list_iteration); // exact match is unlinked and returned
+            }
+            if (block_to_split == NULL && block_size >= size + MIN_BLOCK_SIZE) {
+                block_to_split = free_list_iteration;
+            }
+            free_list_iteration = free_list_iteration->body.links.next; // Move to the next block
+        }
     }
 
-    sf_block *satisfying_block_with_waste_space = find_and_allocate_block_no_split_waste_space(free_list_index_matched, size);
-    if (satisfying_block_with_waste_space != NULL) {
-        return satisfying_block_with_waste_space;
+    if (block_to_split == NULL) {
+        uint64_t higher_lists = sf_free_list_bitmap & ~((FREE_LIST_BIT(free_list_index_matched) << 1) - 1);
+        if (higher_lists == 0) return NULL;
+
+        block_to_split = first_fit_candidate(&sf_default_lists, __builtin_ctzll(higher_lists), size);
     }
 
-    return NULL;
+    return allocate_block_with_split_from_free(block_to_split, block_to_split, size + MIN_BLOCK_SIZE);
 }
 
 int init_heap() {
     // Grow the heap by one page
-    sf_block *heap_start = sf_mem_grow();
+    sf_block *heap_start = heap_mem_grow();
     if (heap_start == NULL) {
         //fprintf(stderr, "ERROR: initializing heap, sf_errno set\n");
         sf_errno = ENOMEM;
         return 0;
     }
+    stat_record_heap_growth();
+    zero_watermark_grown(heap_mem_start());
 
-    void *startAddr = sf_mem_start();
+    void *startAddr = heap_mem_start();
 
     startAddr = padding(startAddr);
 
@@ -683,20 +823,16 @@ int init_heap() {
     set_prev_alloc_bit(prologue, 0);
 
     // Set up the epilogue in-place
-    void *endAddr = sf_mem_end() - EPILOGUE_SIZE;
+    void *endAddr = heap_mem_end() - EPILOGUE_SIZE;
     sf_block *epilogue = (sf_block *)endAddr;
     epilogue->header = (size_t)16;  // Only the header with block size 0 and allocated bit
 
     // Initialize the wilderness block in between prologue and epilogue
-    size_t size_block = (sf_mem_end() - EPILOGUE_SIZE) - (startAddr + PROLOGUE_SIZE) + EPILOGUE_SIZE;
+    size_t size_block = (heap_mem_end() - EPILOGUE_SIZE) - (startAddr + PROLOGUE_SIZE) + EPILOGUE_SIZE;
     sf_block *firstBlock = (sf_block *)(startAddr + PROLOGUE_SIZE);
     firstBlock->header = size_block;
 
-    firstBlock->body.links.next = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-    firstBlock->body.links.prev = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-
-    sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next = firstBlock;
-    sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev = firstBlock;
+    insert_block_to_free_list(firstBlock);
 
     // Set footer identical to header for the free block
     sf_block *footer = (sf_block *)((char *)endAddr - EPILOGUE_SIZE);
@@ -712,12 +848,28 @@ int init_heap() {
 }
 
 int check_initialized_heap() {
-    if (sf_mem_start() == sf_mem_end()) {
+#ifdef SF_THREADS
+    // Other threads must not see the heap until init_heap has finished writing it
+    if (__atomic_load_n(&heap_initialized, __ATOMIC_ACQUIRE)) return 1;
+
+    SF_LOCK(sf_grow_lock);
+    if (!heap_initialized) {
+        build_size_class_table();
+        initialize_free_lists(0);
+
+        if (init_heap() != 0) __atomic_store_n(&heap_initialized, 1, __ATOMIC_RELEASE);
+    }
+    SF_UNLOCK(sf_grow_lock);
+    return heap_initialized;
+#else
+    if (heap_mem_start() == heap_mem_end()) {
+        build_size_class_table();
         initialize_free_lists(0);
 
         if (init_heap() == 0) return 0;
     }
     return 1;
+#endif
 }
 
 sf_block *create_allocated_block(sf_block *free_list_block_ret) {
@@ -737,6 +889,47 @@ sf_block *create_allocated_block(sf_block *free_list_block_ret) {
     return free_list_block_ret;
 }
 
+/*
+    Takes an aligned block size and returns an allocated block from the shared free lists.
+    On a miss the heap grows by all the pages the block needs in one step, and the search runs
+    again; it only runs more than once when the heap ran out of memory part way through.
+*/
+sf_block *allocate_block_from_heap(size_t size_align) {
+#ifdef SF_THREADS
+    return allocate_block_locked(size_align);
+#endif
+    if (!check_initialized_heap()) return NULL;
+
+    sf_block *free_list_block_ret = get_free_list_block(size_align);
+    while (free_list_block_ret == NULL) {
+        if (!quick_consolidate()) { // merging the deferred blocks may make room, otherwise the heap has to grow
+            sf_block *more_memory = grow_heap(heap_growth_pages(size_align));
+            if (!more_memory) { // no more memory can be added
+                //fprintf(stderr, "ERROR: growing the heap, sf_errno set\n");
+                sf_errno = ENOMEM;
+                return NULL;
+            }
+        }
+        free_list_block_ret = get_free_list_block(size_align); // try to find allocate space in free list again
+    }
+
+    return create_allocated_block(free_list_block_ret);
+}
+
+/*
+    Same as allocate_block_from_heap, but only looks at memory that is already free and
+    never grows the heap.  Returns NULL if no free block is large enough.
+*/
+sf_block *take_free_block(size_t size_align) {
+#ifdef SF_THREADS
+    return take_free_block_locked(size_align);
+#endif
+    sf_block *free_list_block_ret = get_free_list_block(size_align);
+    if (free_list_block_ret == NULL) return NULL;
+
+    return create_allocated_block(free_list_block_ret);
+}
+
 /*
  * This is your implementation of sf_malloc. It acquires uninitialized memory that
  * is aligned and padded properly for the underlying system.
@@ -750,26 +943,62 @@ sf_block *create_allocated_block(sf_block *free_list_block_ret) {
  */
 void *sf_malloc(size_t size) {
     sf_errno = 0;
+    SF_STAT_ADD(malloc_calls, 1);
 
     if (size == 0) return NULL;
 
-    if (!check_initialized_heap()) return NULL;
+    void *payload;
+    if (sf_profile_rate != 0 && profile_sample_due(size)) {
+        payload = allocate_block_payload(size); // a sampled allocation needs a header to mark
+        if (payload != NULL) profile_record(payload, size);
+    } else {
+        payload = allocate_payload(size);
+    }
+    if (payload == NULL) SF_STAT_ADD(failed_allocations, 1);
+
+    return payload;
+}
+
+/*
+    The work of sf_malloc for a nonzero size, without counting a call.  sf_realloc and the slab
+    layer use it when the data has to move, so the call they were given is the only one counted.
+    Returns NULL with sf_errno set to ENOMEM if there is no memory.
+*/
+void *allocate_payload(size_t size) {
+    // While a region is held everything comes from it, so that it can all be released in one step
+    int in_region = region_is_active();
+
+    // The smallest requests are objects in a slab, with no header and no coalescing
+    if (!in_region && sf_slab_enabled && size <= SLAB_MAX_SIZE) return slab_alloc(size);
+
+    return allocate_block_payload(size);
+}
+
+/*
+    allocate_payload for a request that has to get a block with a header, even if it is small
+    enough for a slab.
+*/
+void *allocate_block_payload(size_t size) {
+    int in_region = region_is_active();
 
     size_t size_align = align_size(size);
     if (!size_align) return NULL;
 
-    sf_block *free_list_block_ret = get_free_list_block(size_align);
-    while (free_list_block_ret == NULL) {
-        sf_block *more_memory = grow_heap();
-        if (!more_memory) { // no more memory can be added
-            //fprintf(stderr, "ERROR: growing the heap, sf_errno set\n");
-            sf_errno = ENOMEM;
-            return NULL;
-        }
-        free_list_block_ret = get_free_list_block(size_align); // try to find allocate space in free list again
+    sf_block *allocated_block;
+    if (in_region) {
+        allocated_block = region_allocate_block(size_align, MIN_BLOCK_SIZE);
+    } else if (mmap_wanted(size_align)) {
+        // Large blocks get their own mapping, which goes back to the OS when they are freed
+        allocated_block = mmap_allocate_block(size_align, MIN_BLOCK_SIZE);
+    } else if (sf_tcache_enabled && size_align <= TCACHE_MAX_SIZE) {
+        // Small requests are served from the calling thread's cache without touching the shared free lists
+        allocated_block = tcache_get_block(size_align);
+    } else {
+        allocated_block = NULL;
+        if (sf_quick_limit != 0 && size_align <= QUICK_MAX_SIZE) allocated_block = quick_get_block(size_align);
+        if (allocated_block == NULL) allocated_block = allocate_block_from_heap(size_align);
     }
-
-    sf_block *allocated_block = create_allocated_block(free_list_block_ret);
+    if (allocated_block == NULL) return NULL; // sf_errno already set
 /*
     sf_show_block(allocated_block);
     fprintf(stderr, "\n");
@@ -777,6 +1006,8 @@ void *sf_malloc(size_t size) {
     sf_show_heap();
     fprintf(stderr, "\n");
 */
+    stat_record_allocation(size, get_block_size(allocated_block));
+
     void *payload = (void *)((char *)allocated_block + sizeof(sf_header));
 
     return payload;
@@ -798,20 +1029,74 @@ void *sf_malloc(size_t size) {
 */
 int check_pointer(void *ptr, sf_block *block) {
     if ((uintptr_t)ptr & 31) return 1;
-    if (get_block_size(block) < 32) return 1;
-    if (get_block_size(block) % 32 != 0) return 1;
-    if ((void *)block < sf_mem_start()) return 1;
-    if ((void *)block + get_block_size(block) > sf_mem_end()) return 1;
-    if (!get_curr_alloc_bit(block)) return 1;
+#ifdef SF_THREADS
+    // A neighbor may be flipping the prev alloc bit of this header, so read it under its stripe
+    lock_block_tags(block);
+#endif
+    int block_invalid = 0;
+    if (get_block_size(block) < 32) block_invalid = 1;
+    else if (get_block_size(block) % 32 != 0) block_invalid = 1;
+    else if ((void *)block < heap_mem_start()) block_invalid = 1;
+    else if ((void *)block + get_block_size(block) > heap_mem_end()) block_invalid = 1;
+    else if (!get_curr_alloc_bit(block)) block_invalid = 1;
+    else if (block->header & CACHED_BLOCK) block_invalid = 1; // already freed into a thread cache
+#ifdef SF_THREADS
+    unlock_block_tags(block);
+#endif
+    if (block_invalid) return 1;
+
+    int prev_invalid = 0;
+#ifdef SF_THREADS
+    // Hold the previous block's stripe too so it can't be allocated while it is checked
+    int stripes[3];
+    int count;
+    sf_block *prev_block = lock_block_neighbors(block, stripes, &count);
+    if (prev_block != NULL && get_curr_alloc_bit(prev_block)) prev_invalid = 1;
+    unlock_tag_stripes(stripes, count);
+#else
     if (!get_prev_alloc_bit(block)) {
         sf_footer *prev_footer = (sf_footer *)((char *)block - sizeof(sf_footer));
         size_t prev_block_size = *prev_footer & ~0x1F;
         sf_block *prev_block = (sf_block *)((void *)prev_footer - prev_block_size + sizeof(sf_footer));
-        if ((get_curr_alloc_bit(prev_block))) return 1; // evaluates true when alloc field is anything but 0
+        if ((get_curr_alloc_bit(prev_block))) prev_invalid = 1; // evaluates true when alloc field is anything but 0
     }
+#endif
+    if (prev_invalid) return 1;
     return 0; // the pointer was valid
 }
 
+/*
+    Turns an allocated block back into a free block, coalesces it with its free neighbors
+    and inserts the result into the free lists.  The pointer must already have been validated.
+*/
+void release_block_to_heap(sf_block *block_freed) {
+#ifdef SF_THREADS
+    release_block_locked(block_freed);
+    return;
+#endif
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block_freed)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+
+    // Write the free block information
+    write_block_header(block_freed, get_block_size(block_freed), prev_bit, 0);
+
+    sf_block *next_free_block = NULL;
+    sf_block *prev_free_block = NULL;
+
+    block_freed->body.links.next = next_free_block;
+    block_freed->body.links.prev = prev_free_block;
+
+    sf_block *next_block = get_block_end(block_freed);
+    set_prev_alloc_bit(next_block, get_curr_alloc_bit(block_freed));
+
+    block_freed = coalesce(block_freed);
+
+    add_block_free_list_LIFO(block_freed);
+}
+
 /*
  * Marks a dynamically allocated region as no longer in use.
  * Adds the newly freed block to the free list.
@@ -821,40 +1106,185 @@ int check_pointer(void *ptr, sf_block *block) {
  * If ptr is invalid, the function calls abort() to exit the program.
  */
 void sf_free(void *ptr) {
+    SF_STAT_ADD(free_calls, 1);
+    free_payload(ptr);
+}
+
+/*
+    The work of sf_free without counting a call, for sf_realloc and the slab layer.
+*/
+void free_payload(void *ptr) {
+    sf_slab *slab = slab_lookup(ptr); // slab objects have no header to check
+    if (slab != NULL) {
+        slab_free(slab, ptr);
+        return;
+    }
+
     sf_block *block_freed = (void *)((char *)ptr - sizeof(sf_header));
+    if (mmap_owns_block(block_freed)) {
+        mmap_free_block(block_freed);
+        return;
+    }
 
-    if (check_pointer(ptr, block_freed)) {
+    if (free_check_due() && check_pointer(ptr, block_freed)) {
         //fprintf(stderr, "ERROR: invalid pointer argument to free, sf_errno set\n");
         sf_errno = EINVAL;
         abort();
     }
+    if (region_owns_block(block_freed)) return; // given back all at once by sf_region_release
 
-    int prev_bit = 0;
-    if (get_prev_alloc_bit(block_freed)) {
-        // means previous bit is allocated set to 1
-        prev_bit = 1;
+    free_block_of_size(block_freed, get_block_size(block_freed));
+}
+
+/*
+    Frees an allocated block of block_size bytes that is not part of a region.  The size is passed
+    in rather than read from the header so sf_free_sized can use the caller's.
+*/
+void free_block_of_size(sf_block *block_freed, size_t block_size) {
+    SF_STAT_SUB(live_bytes, block_size);
+    if (block_freed->header & SAMPLED_BLOCK) profile_retire_block(block_freed);
+
+    // Small blocks are parked in the calling thread's cache instead of being coalesced right away
+    if (sf_tcache_enabled && block_size <= TCACHE_MAX_SIZE) {
+        tcache_put_block(block_freed, block_size);
+        return;
     }
 
-    // Write the free block information
-    write_block_header(block_freed, get_block_size(block_freed), prev_bit, 0);
+    // With deferred coalescing, small blocks wait on a quick list until a search misses
+    if (sf_quick_limit != 0 && block_size <= QUICK_MAX_SIZE) {
+        quick_put_block(block_freed, block_size);
+        return;
+    }
 
-    sf_block *next_free_block = NULL;
-    sf_block *prev_free_block = NULL;
+    release_block_to_heap(block_freed);
+    trim_if_due(block_freed, block_size);
+}
 
-    block_freed->body.links.next = next_free_block;
-    block_freed->body.links.prev = prev_free_block;
+/*
+    Returns 1 if this free has to run check_pointer.  With SF_OPT_FREE_CHECK set to n, only every
+    n-th free of each thread is checked, and none are when it is 0.
+*/
+int free_check_due(void) {
+    static SF_THREAD_LOCAL size_t frees_until_check;
 
-    sf_block *next_block = get_block_end(block_freed);
-    set_prev_alloc_bit(next_block, get_curr_alloc_bit(block_freed));
+    size_t interval = sf_free_check_interval;
+    if (interval == 1) return 1;
+    if (interval == 0) return 0;
 
-    block_freed = coalesce(block_freed);
+    if (frees_until_check == 0 || frees_until_check > interval) frees_until_check = interval;
+    return --frees_until_check == 0;
+}
 
-    add_block_free_list_LIFO(block_freed);
-    return;
+/*
+    sf_free for a caller that knows the size it allocated.  The size rules out slab objects without
+    looking the pointer up when it is larger than any slab object, and picks the thread cache bin or
+    free list without decoding the header.  When the free is checked the size must match the block,
+    give or take the slack a shrinking sf_realloc may have kept (SF_OPT_REALLOC_SLACK).
+*/
+void sf_free_sized(void *ptr, size_t size) {
+    SF_STAT_ADD(free_calls, 1);
+
+    sf_slab *slab = (size <= SLAB_MAX_SIZE) ? slab_lookup(ptr) : NULL; // a slab object never holds more
+    if (slab != NULL) {
+        slab_free(slab, ptr);
+        return;
+    }
+
+    sf_block *block_freed = (void *)((char *)ptr - sizeof(sf_header));
+    size_t size_align = align_size(size);
+    if (mmap_owns_block(block_freed)) { // rounded up to whole pages, so the size isn't checked
+        mmap_free_block(block_freed);
+        return;
+    }
+
+    int checked = free_check_due();
+    if (checked && check_pointer(ptr, block_freed)) {
+        sf_errno = EINVAL;
+        abort();
+    }
+    if (region_owns_block(block_freed)) return; // region blocks may have kept a bigger size when shrunk
+
+    // A shrinking sf_realloc may have left up to sf_realloc_slack bytes in the block
+    size_t slack = sf_realloc_slack;
+    if (slack != 0) {
+        size_t block_size = get_block_size(block_freed);
+        if (size_align < block_size && block_size - size_align <= slack) size_align = block_size;
+    }
+    if (checked && size_align != get_block_size(block_freed)) {
+        sf_errno = EINVAL; // not the size this block was allocated with
+        abort();
+    }
+
+    free_block_of_size(block_freed, size_align);
+}
+
+/*
+    Returns the number of bytes the caller may use at ptr: the whole slab object, or everything
+    after the header of the block, which is at least what was asked for.  The pointer is not
+    validated, so it has to be one that could be passed to sf_free.
+*/
+size_t sf_usable_size(void *ptr) {
+    if (ptr == NULL) return 0;
+
+    sf_slab *slab = slab_lookup(ptr);
+    if (slab != NULL) return slab_usable_size(slab);
+
+    sf_block *block = (void *)((char *)ptr - sizeof(sf_header));
+    return get_block_size(block) - sizeof(sf_header);
+}
+
+/*
+    Grows an allocated block in place to size_align bytes by absorbing the free block after it.
+    When the block, or the free block after it, is the last one before the epilogue, the heap is
+    grown first so there is room.  The part of the absorbed space past size_align is split off and
+    freed again when it is at least MIN_BLOCK_SIZE.
+
+    Returns 1 if the block now holds at least size_align bytes, 0 if it has to be moved.
+*/
+int extend_block_in_place(sf_block *block, size_t size_align) {
+#ifdef SF_THREADS
+    return extend_block_locked(block, size_align);
+#endif
+    sf_block *next_block = get_block_end(block);
+    size_t available = get_block_size(block);
+    if (!get_curr_alloc_bit(next_block)) available += get_block_size(next_block);
+
+    // The epilogue is the only block of size 0
+    int at_heap_end = get_block_size(next_block) == 0 ||
+        (!get_curr_alloc_bit(next_block) && get_block_size(get_block_end(next_block)) == 0);
+    if (available < size_align && at_heap_end) {
+        if (grow_heap(growth_pages_with_ramp(size_align - available)) == NULL) return 0;
+
+        next_block = get_block_end(block); // the new memory was coalesced into one free block after this one
+        available = get_block_size(block) + get_block_size(next_block);
+    }
+    if (available < size_align) return 0;
+
+    if (!get_curr_alloc_bit(next_block)) remove_from_free_list(next_block);
+
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+
+    if (available - size_align >= MIN_BLOCK_SIZE) {
+        write_block_header(block, size_align, prev_bit, 1);
+        free_portion(get_block_end(block), available - size_align, 1);
+    } else {
+        write_block_header(block, available, prev_bit, 1);
+        set_prev_alloc_bit(get_block_end(block), 1);
+    }
+
+    return 1;
 }
 
 /*
-    When reallocating to a larger size, always follow these three steps:
+    When reallocating to a larger size, first try to grow the block where it is:
+        0) If the block after it is free (or the block is at the end of the heap) and there
+        is enough room, absorb it with extend_block_in_place and return the same pointer.
+
+    Otherwise follow these three steps:
         1) Call sf_malloc to obtain a larger block.
 
         2) Call memcpy to copy the data in the block given by the client to the block
@@ -870,13 +1300,18 @@ void sf_free(void *ptr) {
     take care of this.
 */
 void *sf_realloc_larger_size(void *ptr, size_t size, sf_block* client_block) {
-    sf_block *larger_block = sf_malloc(size); // (step 1)
-
-    memcpy(larger_block, ptr, get_block_size(client_block) - sizeof(sf_header)); // (step 2 - copies the payload)
+    // Region blocks are never grown in place: the heap behind them belongs to the region.  Neither are
+    // blocks growing past the mmap threshold, which move to a mapping of their own
+    size_t size_align = align_size(size);
+    int to_mapping = mmap_wanted(size_align) && !region_is_active();
+    if (!region_owns_block(client_block) && !to_mapping && extend_block_in_place(client_block, size_align)) return ptr; // (step 0)
 
+    sf_block *larger_block = allocate_payload(size); // (step 1)
     if (larger_block == NULL) return NULL; // (appended note)
 
-    sf_free(ptr); // (step 3)
+    memcpy(larger_block, ptr, get_block_size(client_block) - sizeof(sf_header)); // (step 2 - copies the payload)
+
+    free_payload(ptr); // (step 3)
 
     return (void *)larger_block;
 }
@@ -898,14 +1333,35 @@ void *sf_realloc_larger_size(void *ptr, size_t size, sf_block* client_block) {
     When reallocating to a smaller size, your allocator must use the block that was
     passed by the caller.  You must attempt to split the returned block.
 
-    The two sub cases are already handeled by the way my malloc functions.
+    A tail of up to sf_realloc_slack bytes is left in the block too (hysteresis): a buffer that
+    shrinks and grows back within it is neither split nor merged again, since growing into the
+    slack takes the size_align <= block size path of sf_realloc as well.
+
+    The tail is freed in one step: if the block after it is free, it is taken off its list and
+    the tail is written over both, so there is no separate coalesce.  Otherwise that block is told
+    its predecessor is now free.
 */
 void *sf_realloc_smaller_size(void *ptr, size_t size_req_aligned) {
     sf_block *client_block = (void *)((char *)ptr - sizeof(sf_header));
 
     size_t remaining_size = get_block_size(client_block) - size_req_aligned;
-    if (remaining_size < MIN_BLOCK_SIZE) {
-        return ptr; // splitting would cause a splinter update the header field with what?
+    if (remaining_size < MIN_BLOCK_SIZE || remaining_size <= sf_realloc_slack) {
+        return ptr; // splitting would cause a splinter, or the tail is within the slack
+    }
+
+    SF_STAT_ADD(splits, 1);
+#ifdef SF_THREADS
+    shrink_block_locked(client_block, size_req_aligned);
+    return ptr;
+#endif
+
+    sf_block *next_block = get_block_end(client_block);
+    if (!get_curr_alloc_bit(next_block)) {
+        remove_from_free_list(next_block); // the tail takes it over
+        remaining_size += get_block_size(next_block);
+        SF_STAT_ADD(coalesces, 1);
+    } else {
+        set_prev_alloc_bit(next_block, 0);
     }
 
     int prev_bit = 0;
@@ -917,12 +1373,9 @@ void *sf_realloc_smaller_size(void *ptr, size_t size_req_aligned) {
     // Write header for the allocated block
     sf_block *allocated_portion = write_block_header(client_block, size_req_aligned, prev_bit, 1);
 
-    // Write the portion for the free block
-    sf_block *new_free_block = write_block_header(((sf_block *)((void *)allocated_portion + get_block_size(allocated_portion))), remaining_size, prev_bit, 0);
-    // sf_show_block(new_free_block);
-    // fprintf(stderr, "\n");
-
-    add_block_free_list_LIFO(new_free_block);
+    // Write the portion for the free block, its previous block is the allocated portion
+    sf_block *new_free_block = write_block_header(get_block_end(allocated_portion), remaining_size, 1, 0);
+    insert_block_to_free_list(new_free_block);
 
     return ptr;
 }
@@ -943,7 +1396,23 @@ void *sf_realloc_smaller_size(void *ptr, size_t size_req_aligned) {
  * the allocated block and return NULL without setting sf_errno.
 */
 void *sf_realloc(void *ptr, size_t size) {
+    SF_STAT_ADD(realloc_calls, 1);
+
+    sf_slab *slab = slab_lookup(ptr);
+    if (slab != NULL) return slab_realloc(slab, ptr, size);
+
     sf_block *realloc_block = (void *)((char *)ptr - sizeof(sf_header));
+    if (mmap_owns_block(realloc_block)) {
+        if (size == 0) {
+            mmap_free_block(realloc_block);
+            return NULL;
+        }
+        if (realloc_block->header & SAMPLED_BLOCK) profile_retire_block(realloc_block); // its header is rewritten
+        void *payload = mmap_realloc(ptr, realloc_block, size);
+        if (payload == NULL) SF_STAT_ADD(failed_allocations, 1);
+        else if (sf_profile_rate != 0 && profile_sample_due(size)) profile_record(payload, size);
+        return payload;
+    }
 
     if (check_pointer(ptr, realloc_block)) {
         //fprintf(stderr, "ERROR: invalid pointer argument to realloc, sf_errno set\n");
@@ -951,26 +1420,47 @@ void *sf_realloc(void *ptr, size_t size) {
         return NULL;
     }
 
-    if (size == 0) {
-        sf_free(ptr); // realloc size 0 then free
-    }
+    // A sampled block is retired before it is resized or moved, and the result sampled again if due
+    if (realloc_block->header & SAMPLED_BLOCK) profile_retire_block(realloc_block);
 
-    if (align_size(size) == get_block_size(realloc_block)) {
-        return ptr; // nothing to be reallocated
+    if (size == 0) {
+        free_payload(ptr); // realloc size 0 then free
+        return NULL;
     }
 
-    if (size > get_block_size(realloc_block)) {
-        return sf_realloc_larger_size(ptr, size, realloc_block);
+    // Compare block sizes, not the requested size, so a request just under the block size isn't a "smaller" one
+    size_t size_align = align_size(size);
+    size_t old_block_size = get_block_size(realloc_block);
+    void *payload;
+    if (size_align == old_block_size) {
+        payload = ptr; // nothing to be reallocated
+    } else if (size_align > old_block_size) {
+        payload = sf_realloc_larger_size(ptr, size, realloc_block);
+    } else if (region_owns_block(realloc_block)) {
+        payload = ptr; // a tail split off a region block could never be reused before the region is released
+    } else {
+        payload = sf_realloc_smaller_size(ptr, size_align);
     }
 
-    if (size < get_block_size(realloc_block)) {
-        return sf_realloc_smaller_size(ptr, align_size(size));
+    // A block that moved was already counted by allocate_payload and free_payload
+    if (payload == ptr) {
+        SF_STAT_SUB(live_bytes, old_block_size);
+        stat_record_allocation(size, get_block_size(realloc_block));
+    } else if (payload == NULL) {
+        SF_STAT_ADD(failed_allocations, 1);
     }
+    if (payload != NULL && sf_profile_rate != 0 && profile_sample_due(size)) profile_record(payload, size);
 
-    return NULL;
+    return payload;
 }
 
 sf_block *free_portion(sf_block *free_part, size_t size, int prev_bit) {
+    SF_STAT_ADD(splits, 1);
+#ifdef SF_THREADS
+    write_claimed_block_header(free_part, size, prev_bit);
+    release_block_locked(free_part);
+    return free_part;
+#endif
     write_block_header(free_part, size, prev_bit, 0);
 
     sf_block *next_free_block = NULL;
@@ -989,72 +1479,129 @@ sf_block *free_portion(sf_block *free_part, size_t size, int prev_bit) {
     return free_part;
 }
 
-sf_block *remove_front_free(sf_block *block_allocated, size_t offset, size_t adjusted_size) {
-    int prev_bit = get_prev_alloc_bit(block_allocated);
-
-    sf_block *free_start = free_portion(block_allocated, offset, prev_bit);
+/*
+    Returns how far into a free block of block_size bytes a block of size_align bytes can start so
+    that its payload is a multiple of align, or NO_ALIGNED_FIT if it doesn't fit there.
 
-    sf_block *temp_block = write_block_header(get_block_end(free_start), align_size(adjusted_size) - offset, 0, 1);
-    set_prev_alloc_bit(get_block_end(temp_block), 1);
+    Every payload is already a multiple of 32 and align is a power of two of at least 32, so the
+    offset is a multiple of 32 as well: the part in front is either empty or a whole free block.
+*/
+size_t aligned_block_offset(sf_block *block, size_t block_size, size_t size_align, size_t align) {
+    uintptr_t payload = (uintptr_t)block + sizeof(sf_header);
+    size_t offset = (size_t)(((payload + align - 1) & ~(uintptr_t)(align - 1)) - payload);
 
-    return temp_block;
+    if (offset > block_size || block_size - offset < size_align) return NO_ALIGNED_FIT;
+    return offset;
 }
 
-void remove_end_free(sf_block *temp_block, size_t adjusted_size, size_t size, size_t offset) {
-    int prev_bit = get_prev_alloc_bit(temp_block);
-    int free_block_size = align_size(adjusted_size) - align_size(size) - offset + MIN_BLOCK_SIZE;
+/*
+    Turns a free block that is no longer on a free list into an allocated block of size_align bytes
+    starting offset bytes in, as found by aligned_block_offset.  The part in front (if any) and the
+    part after it (if it is at least MIN_BLOCK_SIZE) go back on the free lists; their other
+    neighbors are allocated, since the free block was already coalesced, so there is nothing to merge.
+*/
+sf_block *carve_aligned_block(sf_list_set *lists, sf_block *free_block, size_t offset, size_t size_align) {
+    size_t remaining_size = get_block_size(free_block) - offset;
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(free_block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
 
-    sf_block *aligned_block = write_block_header(temp_block, align_size(size), prev_bit, 1);
-    set_prev_alloc_bit(get_block_end(temp_block), 1);
+    sf_block *aligned_block = free_block;
+    if (offset > 0) {
+        write_block_header(free_block, offset, prev_bit, 0);
+        insert_block_to_lists(lists, free_block);
+        SF_STAT_ADD(splits, 1);
 
-    free_portion(get_block_end(aligned_block), free_block_size, 1); // writing the end free block
-}
+        aligned_block = (sf_block *)((char *)free_block + offset);
+        prev_bit = 0;
+    }
 
-void malloc_ret_aligned_addr(sf_block *block_allocated, size_t adjusted_size, size_t size) {
-        int prev_bit = get_prev_alloc_bit(block_allocated);
-        int free_block_size = align_size(adjusted_size) - align_size(size);
+    if (remaining_size - size_align >= MIN_BLOCK_SIZE) {
+        write_block_header(aligned_block, size_align, prev_bit, 1);
 
-        sf_block *aligned_block = write_block_header(block_allocated, align_size(size), prev_bit, 1);
+        sf_block *tail = write_block_header(get_block_end(aligned_block), remaining_size - size_align, 1, 0);
+        insert_block_to_lists(lists, tail);
+        SF_STAT_ADD(splits, 1);
+    } else {
+        write_block_header(aligned_block, remaining_size, prev_bit, 1);
         set_prev_alloc_bit(get_block_end(aligned_block), 1);
+    }
 
-        free_portion(get_block_end(aligned_block), free_block_size, 1); // writing the end free block
+    return aligned_block;
 }
 
-void *increment_address(void *aligned_address) {
-    return (void *)((char *)aligned_address + sizeof(sf_header));
-}
+/*
+    The blocks of free list index to try for a size_align byte block, in the order they are tried:
+    list order, except on the last list, where the tree hands them out best fit first starting with
+    the smallest block that is big enough.  The candidates end with NULL.
+*/
+sf_block *first_fit_candidate(sf_list_set *lists, int index, size_t size_align) {
+    if (index == LAST_FREE_LIST) return tree_best_fit(*lists->large_root, size_align);
 
-size_t update_offset(size_t offset) {
-    return offset += sizeof(sf_header);
+    sf_block *free_list_head = &lists->heads[index];
+    sf_block *block = free_list_head->body.links.next;
+    return (block != free_list_head) ? block : NULL;
 }
 
-void addr_aligned_free_end(void *block_payload, size_t adjusted_size, size_t size) {
-    // JUST FREE THE END PORTION OFF (MALLOC ALREADY RETURNED AN ALIGNED ADDRESS FOR THE HEADER OF THE ALLOCATED BLOCK)
-    // malloc returns a pointer to the payload of the allocated block, so move up pointer to actual block start (header)
+sf_block *next_fit_candidate(sf_list_set *lists, int index, sf_block *block) {
+    if (index == LAST_FREE_LIST) return tree_next_block(*lists->large_root, block);
 
-    sf_block *block_allocated = (void *)((char *)block_payload - sizeof(sf_header));
-    malloc_ret_aligned_addr(block_allocated, adjusted_size, size);
+    sf_block *next_block = block->body.links.next;
+    return (next_block != &lists->heads[index]) ? next_block : NULL;
 }
 
-void *chng_addr_free_front_end(void *block_payload, size_t adjusted_size, size_t size, size_t align) {
-    // malloc returns a pointer to the payload of the allocated block, so move up pointer to actual block start (header)
-    sf_block *block_allocated = (void *)((char *)block_payload - sizeof(sf_header));
+/*
+    First fit over the free lists for a free block that holds a size_align byte block with an
+    align-aligned payload somewhere inside it.  Lists below the one size_align maps to can't hold
+    one, and empty lists are skipped through the bitmap.  Returns the allocated block, or NULL.
+    Not locked: in SF_THREADS builds it is only used on the lists of an arena, under the arena's lock.
+*/
+sf_block *take_aligned_free_block(sf_list_set *lists, size_t size_align, size_t align) {
+    for (int index = get_free_list_index(size_align); index < sf_num_free_lists; index++) {
+        if (!(*lists->bitmap & FREE_LIST_BIT(index))) continue;
 
-    size_t offset = MIN_BLOCK_SIZE;
-    void *aligned_address = (void *)((char *)block_allocated + MIN_BLOCK_SIZE);
+        for (sf_block *block = first_fit_candidate(lists, index, size_align); block != NULL; block = next_fit_candidate(lists, index, block)) {
+            size_t offset = aligned_block_offset(block, get_block_size(block), size_align, align);
+            if (offset == NO_ALIGNED_FIT) continue;
 
-    while (((uintptr_t)aligned_address % align) != 0 ) {
-        aligned_address = increment_address(aligned_address);
-        offset = update_offset(offset);
+            remove_block_from_lists(lists, block);
+            return carve_aligned_block(lists, block, offset, size_align);
+        }
     }
+    return NULL;
+}
+
 /*
-    fprintf(stderr, "This is the aligned address: %p\n", aligned_address);
+    Space the heap has to have free at its end so a size_align byte block with an align-aligned
+    payload is sure to fit: the aligned payload is less than align bytes past the start of the block.
 */
-    sf_block *temp_block = remove_front_free(block_allocated, offset, adjusted_size);
+size_t aligned_fit_size(size_t size_align, size_t align) {
+    return size_align + align - MIN_BLOCK_SIZE;
+}
 
-    remove_end_free(temp_block, adjusted_size, size, offset);
+/*
+    Same as allocate_block_from_heap, but the payload of the block is a multiple of align.
+    Returns NULL with sf_errno set to ENOMEM if the heap can't hold it.
+*/
+sf_block *allocate_aligned_block_from_heap(size_t size_align, size_t align) {
+    if (region_is_active()) return region_allocate_block(size_align, align);
+#ifdef SF_THREADS
+    return allocate_aligned_block_locked(size_align, align);
+#endif
+    if (!check_initialized_heap()) return NULL;
+
+    sf_block *aligned_block = take_aligned_free_block(&sf_default_lists, size_align, align);
+    while (aligned_block == NULL) {
+        if (!quick_consolidate() && !grow_heap(heap_growth_pages(aligned_fit_size(size_align, align)))) { // no more memory can be added
+            sf_errno = ENOMEM;
+            return NULL;
+        }
+        aligned_block = take_aligned_free_block(&sf_default_lists, size_align, align);
+    }
 
-    return aligned_address;
+    return aligned_block;
 }
 
 /*
@@ -1075,6 +1622,7 @@ void *sf_memalign(size_t size, size_t align) {
     // this function ensures that the allocated memory block starts at an address that is a multiple of the alignment value provided by the user
     // the "align" argument will specify how the starting address of the allocated block should be aligned
     // to be successful the aligned block address must meet the condition: block_address % alignment = 0
+    SF_STAT_ADD(memalign_calls, 1);
 
     // Ensure alignment is a power of two and greater than or equal to the minimum block size
     if (align < MIN_BLOCK_SIZE|| (align & (align - 1)) != 0) {
@@ -1085,43 +1633,86 @@ void *sf_memalign(size_t size, size_t align) {
 
     if (size == 0) return NULL;
 
-    // in order to obtain memory with the requested alignment, memalign allocates a larger block than requested
-    // it attempts to allocate a block size (at least) >= requested size + alignment size + minimum blocksize + size required for header and footer
-
-    size_t adjusted_size = size + align + MIN_BLOCK_SIZE + sizeof(sf_footer); // the size space for the header is added in malloc when aligning the size to multiples 32
-    // since can't control where the memory will be initially allocated, need to allocate slightly more memory than requested to allow for adjustment
-
-    void *block_payload = sf_malloc(adjusted_size); // allocating the block
-    if (block_payload == NULL) {
-        //fprintf(stderr, "ERROR: in memalign returned from malloc, sf_errno set\n");
+    // instead of allocating size + align bytes and trimming both ends, the free lists are searched for a
+    // free block that already has an aligned payload position with room for the block, and only the
+    // parts in front of and after that position are split off (see aligned_block_offset)
+    size_t size_align = align_size(size);
+    sf_block *aligned_block = NULL;
+    if (size_align && mmap_wanted(size_align) && !region_is_active()) aligned_block = mmap_allocate_block(size_align, align);
+    else if (size_align && size_align < SIZE_MAX - align) aligned_block = allocate_aligned_block_from_heap(size_align, align);
+    if (aligned_block == NULL) {
+        //fprintf(stderr, "ERROR: in memalign no aligned block, sf_errno set\n");
+        SF_STAT_ADD(failed_allocations, 1);
         sf_errno = ENOMEM;
         return NULL;
     }
-
-    // after allocating the block, must find address that meets alignment requirements
-    // adjust the address by adding the offset until find satisfying aligned address
-
-    if (((uintptr_t)block_payload % align) == 0) {
 /*
-        fprintf(stderr, "This is the memory address returned by malloc: %p and this was the align value: %ld\n", block_payload, align);
-
-        fprintf(stderr, "I don't know how to write the criterion tests so it also knows this is correct\n");
-        sf_show_heap();
-        fprintf(stderr, "\n");
+    fprintf(stderr, "Expected size of used block %ld\n", align_size(size));
+    sf_show_heap();
 */
+    stat_record_allocation(size, get_block_size(aligned_block));
 
-        addr_aligned_free_end(block_payload, adjusted_size, size);
-/*
-        fprintf(stderr, "Expected size of used block %ld\n", align_size(size));
-        sf_show_heap();
-*/
-        return block_payload; // this address is already aligned
+    void *payload = (char *)aligned_block + sizeof(sf_header); // the correctly aligned address for the user
+    if (sf_profile_rate != 0 && profile_sample_due(size)) profile_record(payload, size);
+    return payload;
+}
+
+int sf_mallopt(int option, size_t value) {
+    switch (option) {
+    case SF_OPT_TCACHE:
+        if (sf_tcache_enabled && !value) {
+            sf_tcache_flush(); // cached blocks would otherwise be stranded
+        }
+        sf_tcache_enabled = (value != 0);
+        return 1;
+    case SF_OPT_TCACHE_COUNT:
+        if (value < 1 || value > TCACHE_MAX_COUNT) break;
+        sf_tcache_count = value;
+        return 1;
+    case SF_OPT_SLAB:
+        sf_slab_enabled = (value != 0);
+        return 1;
+    case SF_OPT_FREE_CHECK:
+        sf_free_check_interval = value;
+        return 1;
+    case SF_OPT_DEFER_COALESCE:
+        sf_quick_limit = value;
+        if (!value) {
+            quick_consolidate(); // deferred blocks would otherwise be stranded
+        }
+        return 1;
+    case SF_OPT_SIZE_CLASSES:
+        if (value > SF_CLASSES_QUARTER) break;
+        SF_LOCK(sf_grow_lock);
+        if (heap_mem_start() != heap_mem_end()) { // the free lists are already sorted by the current scheme
+            SF_UNLOCK(sf_grow_lock);
+            break;
+        }
+        sf_size_class_scheme = (int)value;
+        SF_UNLOCK(sf_grow_lock);
+        return 1;
+    case SF_OPT_MMAP_THRESHOLD:
+        if (value != 0 && value < MMAP_MIN_THRESHOLD) break;
+        sf_mmap_threshold = value;
+        return 1;
+    case SF_OPT_TRIM_THRESHOLD:
+        if (value != 0 && value < TRIM_MIN_THRESHOLD) break;
+        sf_trim_threshold = value;
+        return 1;
+    case SF_OPT_REALLOC_SLACK:
+        sf_realloc_slack = value;
+        return 1;
+    case SF_OPT_PROFILE_RATE:
+        return profile_set_rate(value);
+    case SF_OPT_GROW_MAX_PAGES:
+        if (value < 1 || value > GROW_MAX_PAGES_LIMIT) break;
+        SF_LOCK(sf_grow_lock);
+        sf_grow_max_pages = value;
+        if (grow_chunk_pages > value) grow_chunk_pages = value;
+        SF_UNLOCK(sf_grow_lock);
+        return 1;
     }
 
-    void *aligned_address = chng_addr_free_front_end(block_payload, adjusted_size, size, align);
-/*
-    fprintf(stderr, "Expected size of used block %ld\n", align_size(size));
-    sf_show_heap();
-*/
-    return aligned_address; // return the correctly aligned address to the user (NULL if no memory, will be returned by MALLOC above)
-}
\ No newline at end of file
+    sf_errno = EINVAL;
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+    Mapped blocks: large requests get a mapping of their own instead of a place in the heap.
+
+    A request whose block would be at least sf_mmap_threshold bytes is not searched for in the free
+    lists at all.  It is given fresh pages with mmap, laid out as
+
+        [padding] [sf_mmap_chunk] [header] [payload ...] [unused, under 32 bytes]
+
+    with the payload at the first suitably aligned address that leaves room for the chunk descriptor
+    and the header in front of it.  The header is an ordinary allocated block header with
+    MMAPPED_BLOCK set, so sf_free and sf_realloc can tell the block apart before they look for it in
+    the heap.  The descriptor in front of the header records the mapping (and a check word derived
+    from it), which is everything munmap and mremap need.
+
+    Such a block never fragments the heap and its memory goes back to the OS as soon as it is freed.
+    sf_realloc grows or shrinks it with mremap, moving it only if the kernel has to, and moves it into
+    the heap when it shrinks below the threshold.  The mappings share no state besides the stats, so
+    none of this takes a lock.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // mremap
+#endif
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+size_t sf_mmap_threshold = MMAP_DEFAULT_THRESHOLD; // smallest block that gets its own mapping, 0 while mapping is off
+
+static size_t mmap_page_size(void) {
+    static size_t page_size;
+    size_t size = __atomic_load_n(&page_size, __ATOMIC_RELAXED);
+    if (size == 0) {
+        size = (size_t)sysconf(_SC_PAGESIZE);
+        __atomic_store_n(&page_size, size, __ATOMIC_RELAXED);
+    }
+    return size;
+}
+
+static sf_mmap_chunk *mmap_chunk_of(sf_block *block) {
+    return (sf_mmap_chunk *)((char *)block - sizeof(sf_mmap_chunk));
+}
+
+static uintptr_t mmap_check_word(sf_block *block, size_t map_size) {
+    return (uintptr_t)block ^ map_size ^ MMAP_CHECK_MAGIC;
+}
+
+/*
+    Returns 1 if a block of size_align bytes is to get a mapping of its own.
+*/
+int mmap_wanted(size_t size_align) {
+    size_t threshold = sf_mmap_threshold;
+    return threshold != 0 && size_align >= threshold;
+}
+
+/*
+    Returns 1 if block is the header of a mapped block.  Blocks inside the heap never are; for the
+    others the check word has to match, so a stray pointer with the bit set is not unmapped.
+*/
+int mmap_owns_block(sf_block *block) {
+    if ((void *)block >= heap_mem_start() && (void *)block < heap_mem_end()) return 0;
+    if ((block->header & MMAPPED_BLOCK) == 0 || !get_curr_alloc_bit(block)) return 0;
+
+    sf_mmap_chunk *chunk = mmap_chunk_of(block);
+    return chunk->check == mmap_check_word(block, chunk->map_size);
+}
+
+/*
+    Writes the descriptor and the header of the block whose payload is at payload, in the mapping of
+    map_size bytes at map_start, and returns the block.
+*/
+static sf_block *mmap_write_block(char *map_start, size_t map_size, char *payload) {
+    sf_block *block = (sf_block *)(payload - sizeof(sf_header));
+    sf_mmap_chunk *chunk = mmap_chunk_of(block);
+
+    chunk->map_start = map_start;
+    chunk->map_size = map_size;
+    chunk->check = mmap_check_word(block, map_size);
+
+    size_t block_size = (size_t)(map_start + map_size - (char *)block) & ~(size_t)(MIN_BLOCK_SIZE - 1);
+    write_block_header(block, block_size, 1, 1);
+    block->header |= MMAPPED_BLOCK;
+    return block;
+}
+
+/*
+    Maps a block of at least size_align bytes whose payload is a multiple of align.  Returns NULL
+    with sf_errno set to ENOMEM if the mapping fails.
+*/
+sf_block *mmap_allocate_block(size_t size_align, size_t align) {
+    size_t page_size = mmap_page_size();
+    size_t front = (align > MIN_BLOCK_SIZE) ? align + MIN_BLOCK_SIZE : MIN_BLOCK_SIZE; // room for the descriptor, header and alignment
+    if (size_align > SIZE_MAX - front - page_size) {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+    size_t map_size = (front + size_align + page_size - 1) & ~(page_size - 1);
+
+    char *map_start = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map_start == MAP_FAILED) {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    uintptr_t payload = (uintptr_t)map_start + sizeof(sf_mmap_chunk) + sizeof(sf_header);
+    payload = (payload + align - 1) & ~(uintptr_t)(align - 1);
+
+    SF_STAT_ADD(mapped_bytes, map_size);
+    SF_STAT_ADD(mapped_blocks, 1);
+    return mmap_write_block(map_start, map_size, (char *)payload);
+}
+
+/*
+    Unmaps a mapped block.  Its bytes are no longer live.
+*/
+void mmap_free_block(sf_block *block) {
+    sf_mmap_chunk *chunk = mmap_chunk_of(block);
+    char *map_start = chunk->map_start;
+    size_t map_size = chunk->map_size;
+
+    if (block->header & SAMPLED_BLOCK) profile_retire_block(block);
+    SF_STAT_SUB(live_bytes, get_block_size(block));
+    SF_STAT_SUB(mapped_bytes, map_size);
+    SF_STAT_SUB(mapped_blocks, 1);
+    munmap(map_start, map_size);
+}
+
+/*
+    sf_realloc of a mapped block, which has already been validated.  A size that still wants a
+    mapping resizes the mapping in place, or lets the kernel move it without copying the pages.
+    A smaller one moves the data into the heap, unless the heap can't take it.  Returns NULL with
+    sf_errno set to ENOMEM, and the block untouched, if the block can't be resized.
+*/
+void *mmap_realloc(void *ptr, sf_block *block, size_t size) {
+    size_t size_align = align_size(size);
+    size_t old_block_size = get_block_size(block);
+
+    if (!mmap_wanted(size_align)) {
+        void *moved = allocate_payload(size);
+        if (moved != NULL) {
+            memcpy(moved, ptr, size); // size is smaller than the mapped block
+            mmap_free_block(block);
+            return moved;
+        }
+        sf_errno = 0; // keep it mapped, just smaller
+    }
+
+    sf_mmap_chunk *chunk = mmap_chunk_of(block);
+    char *map_start = chunk->map_start;
+    size_t old_map_size = chunk->map_size;
+    size_t front = (char *)ptr - map_start;
+
+    size_t page_size = mmap_page_size();
+    if (size_align > SIZE_MAX - front - page_size) {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+    size_t map_size = (front + size_align + page_size - 1) & ~(page_size - 1);
+
+    char *new_map_start = mremap(map_start, old_map_size, map_size, MREMAP_MAYMOVE);
+    if (new_map_start == MAP_FAILED) {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    // The pages keep their offsets, so the block is where it was in the mapping, even if that moved
+    sf_block *resized = mmap_write_block(new_map_start, map_size, new_map_start + front);
+    SF_STAT_ADD(mapped_bytes, map_size - old_map_size);
+    SF_STAT_SUB(live_bytes, old_block_size);
+    stat_record_allocation(size, get_block_size(resized));
+    return new_map_start + front;
+}
@@ -0,0 +1,238 @@
+/*
+    Page providers: where the memory of the heap comes from.
+
+    By default the heap is grown with sf_mem_grow from lib/sfutil.o, PAGE_SZ bytes at a time, up to
+    a limit fixed inside the library.  sf_set_page_provider swaps that for one of the providers
+    below, with its own page size and capacity, as long as the heap doesn't exist yet.  Everything
+    else in the allocator asks heap_mem_start, heap_mem_end and heap_mem_grow instead of the sf_mem_*
+    functions, so it doesn't care which provider is in use.
+
+    Every provider hands out one contiguous range of memory, one page at a time from its start:
+        sbrk    moves the program break.  Growth fails once something else has moved the break,
+                since the next page would no longer follow the heap.
+        mmap    reserves capacity bytes of address space without any memory behind it, and makes
+                each page readable and writable as the heap grows into it.  2 MB pages are marked
+                for transparent huge pages.
+        static  cuts the pages out of a buffer supplied by the caller.
+        file    reserves the address space like mmap, and maps each page shared from a file that
+                is extended to cover it, so the heap can live on a tmpfs or hugetlbfs mount.
+
+    A provider only has to reserve its range once and commit a page at a time, so adding another
+    is a matter of two functions and an entry in page_providers.  The heap is only grown under
+    sf_grow_lock; pages_end is published with a release store since the heap bounds are read
+    without it.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sbrk, MAP_NORESERVE, MADV_HUGEPAGE
+#endif
+
+#include "sfmm.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+typedef struct sf_page_ops {
+    int (*reserve)(void); // sets pages_start and pages_limit, before the first page is committed
+    int (*commit)(char *page); // makes the page_size bytes at page usable
+} sf_page_ops;
+
+static int page_provider = SF_PAGES_SFUTIL;
+static size_t page_size = PAGE_SZ;
+static size_t page_capacity; // bytes the provider may hand out, a multiple of page_size
+static char *page_buffer; // the caller's memory for SF_PAGES_STATIC
+static int page_fd = -1; // the backing file for SF_PAGES_FILE
+
+static char *pages_start; // NULL until the provider has reserved its range
+static char *pages_end;
+static char *pages_limit;
+
+/*
+    Reserves page_capacity bytes of address space starting at a multiple of page_size, with no
+    memory behind it yet.  Returns NULL if the address space isn't available.
+*/
+static char *reserve_address_space(void) {
+    size_t span = page_capacity + page_size; // room to move the start up to the alignment
+    char *reserved = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) return NULL;
+
+    char *aligned = (char *)(((uintptr_t)reserved + page_size - 1) & ~(uintptr_t)(page_size - 1));
+    char *aligned_end = aligned + page_capacity;
+    if (aligned > reserved) munmap(reserved, aligned - reserved);
+    if (reserved + span > aligned_end) munmap(aligned_end, reserved + span - aligned_end);
+    return aligned;
+}
+
+static int sbrk_reserve(void) {
+    char *brk_now = sbrk(0);
+    if (brk_now == (char *)-1) return 0;
+
+    size_t pad = (page_size - (uintptr_t)brk_now % page_size) % page_size;
+    if (pad != 0 && sbrk(pad) == (void *)-1) return 0;
+
+    pages_start = brk_now + pad;
+    pages_limit = pages_start + page_capacity;
+    return 1;
+}
+
+static int sbrk_commit(char *page) {
+    if ((char *)sbrk(0) != page) return 0; // someone else moved the break
+    return sbrk(page_size) != (void *)-1;
+}
+
+static int mmap_reserve(void) {
+    pages_start = reserve_address_space();
+    if (pages_start == NULL) return 0;
+    pages_limit = pages_start + page_capacity;
+    return 1;
+}
+
+static int mmap_commit(char *page) {
+    if (mprotect(page, page_size, PROT_READ | PROT_WRITE) != 0) return 0;
+#ifdef MADV_HUGEPAGE
+    if (page_size >= PAGES_MAX_SIZE) madvise(page, page_size, MADV_HUGEPAGE); // only a hint
+#endif
+    return 1;
+}
+
+static int static_reserve(void) {
+    char *start = (char *)(((uintptr_t)page_buffer + MIN_BLOCK_SIZE - 1) & ~(uintptr_t)(MIN_BLOCK_SIZE - 1));
+    size_t usable = page_capacity - (size_t)(start - page_buffer);
+
+    pages_start = start;
+    pages_limit = start + usable / page_size * page_size;
+    return pages_limit > pages_start;
+}
+
+static int static_commit(char *page) {
+    return 1; // the caller's memory is already there
+}
+
+static int file_commit(char *page) {
+    off_t offset = (off_t)(page - pages_start);
+    if (ftruncate(page_fd, offset + (off_t)page_size) != 0) return 0;
+    return mmap(page, page_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, page_fd, offset) != MAP_FAILED;
+}
+
+static const sf_page_ops page_providers[] = {
+    [SF_PAGES_SBRK] = {sbrk_reserve, sbrk_commit},
+    [SF_PAGES_MMAP] = {mmap_reserve, mmap_commit},
+    [SF_PAGES_STATIC] = {static_reserve, static_commit},
+    [SF_PAGES_FILE] = {mmap_reserve, file_commit},
+};
+
+void *heap_mem_start(void) {
+    if (page_provider == SF_PAGES_SFUTIL) return sf_mem_start();
+    return pages_start;
+}
+
+void *heap_mem_end(void) {
+    if (page_provider == SF_PAGES_SFUTIL) return sf_mem_end();
+    return __atomic_load_n(&pages_end, __ATOMIC_ACQUIRE);
+}
+
+size_t heap_page_size(void) {
+    return page_size;
+}
+
+/*
+    Adds one page to the end of the heap, like sf_mem_grow.  Returns the start of the new page, or
+    NULL if the provider has no more pages.  The caller must hold sf_grow_lock.
+*/
+void *heap_mem_grow(void) {
+    if (page_provider == SF_PAGES_SFUTIL) return sf_mem_grow();
+
+    const sf_page_ops *ops = &page_providers[page_provider];
+    if (pages_start == NULL) {
+        if (!ops->reserve()) {
+            pages_start = NULL;
+            return NULL;
+        }
+        __atomic_store_n(&pages_end, pages_start, __ATOMIC_RELEASE);
+    }
+
+    char *page = pages_end;
+    if ((size_t)(pages_limit - page) < page_size || !ops->commit(page)) return NULL;
+
+    __atomic_store_n(&pages_end, page + page_size, __ATOMIC_RELEASE);
+    return page;
+}
+
+/*
+    Returns 1 if sf_trim may give the pages of the heap back with madvise: not when they belong to
+    the caller's buffer, and not when they are backed by a file, which madvise doesn't empty.
+*/
+int heap_pages_releasable(void) {
+    return page_provider != SF_PAGES_STATIC && page_provider != SF_PAGES_FILE;
+}
+
+/*
+    Returns 1 if the pages heap_mem_grow adds are known to be zero filled: fresh anonymous memory,
+    the program break, or a file extended by ftruncate.  The caller's buffer and the pages of
+    lib/sfutil.o may hold anything.
+*/
+int heap_pages_zeroed(void) {
+    return page_provider != SF_PAGES_STATIC && page_provider != SF_PAGES_SFUTIL;
+}
+
+int sf_set_page_provider(const sf_page_config *config) {
+    if (config == NULL || config->provider < SF_PAGES_SFUTIL || config->provider > SF_PAGES_FILE) {
+        sf_errno = EINVAL;
+        return 0;
+    }
+
+    size_t size = config->page_size;
+    size_t capacity = config->capacity;
+    if (config->provider == SF_PAGES_SFUTIL) {
+        if (size == 0) size = PAGE_SZ;
+        if (size != PAGE_SZ) { // the library's pages are what they are
+            sf_errno = EINVAL;
+            return 0;
+        }
+    } else {
+        if (size == 0) size = PAGES_DEFAULT_SIZE;
+        if (capacity == 0 && config->provider != SF_PAGES_STATIC) capacity = PAGES_DEFAULT_CAPACITY;
+
+        int bad_size = size < PAGES_MIN_SIZE || size > PAGES_MAX_SIZE || (size & (size - 1)) != 0;
+        int bad_static = config->provider == SF_PAGES_STATIC && config->buffer == NULL;
+        int bad_file = config->provider == SF_PAGES_FILE && config->path == NULL;
+        if (bad_size || bad_static || bad_file || capacity < size) {
+            sf_errno = EINVAL;
+            return 0;
+        }
+        if (config->provider != SF_PAGES_STATIC) capacity -= capacity % size;
+    }
+
+    SF_LOCK(sf_grow_lock);
+    if (heap_mem_start() != heap_mem_end() || pages_start != NULL) { // the heap already has its pages
+        SF_UNLOCK(sf_grow_lock);
+        sf_errno = EINVAL;
+        return 0;
+    }
+
+    if (config->provider == SF_PAGES_FILE) {
+        int fd = open(config->path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            SF_UNLOCK(sf_grow_lock);
+            sf_errno = errno;
+            return 0;
+        }
+        if (page_fd >= 0) close(page_fd);
+        page_fd = fd;
+    }
+
+    page_provider = config->provider;
+    page_size = size;
+    page_capacity = capacity;
+    page_buffer = config->buffer;
+    SF_UNLOCK(sf_grow_lock);
+    return 1;
+}
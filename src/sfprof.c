@@ -0,0 +1,318 @@
+/*
+    Sampling heap profiler (SF_OPT_PROFILE_RATE).
+
+    With a rate of n, every thread counts down the bytes it asks sf_malloc, sf_realloc and
+    sf_memalign for, and the allocation that takes the count below zero is sampled.  The count is
+    then drawn again from an exponential distribution with mean n, so the sampled allocations form a
+    Poisson process over the bytes allocated: on average one sample per n bytes, and a large
+    allocation is more likely to be sampled than a small one in proportion to its size.  Allocations
+    in between cost one thread local subtraction.
+
+    A sampled allocation gets a backtrace of its caller.  The stack is looked up in stack_table,
+    where each distinct stack keeps the sampled allocations and bytes made from it and those still
+    live, and the allocation is added to sample_table under its payload address.  Its block gets
+    SAMPLED_BLOCK in the header, so the free paths only look the block up when the bit is set.
+    Sampled requests never come from a slab, since slab objects have no header to carry the bit.
+    Nothing is sampled while a region is held: region blocks are given back without being freed.
+
+    sf_profile_dump writes the stacks in the legacy heap profile format of gperftools
+    ("heap profile: ... @ heap_v2/n"), which pprof reads and scales back up by the sampling rate.
+    The dump is formatted into a stack buffer and written with write(), so it doesn't allocate.
+
+    Both tables are mapped the first time profiling is turned on and never freed.  When either is
+    full, further samples are dropped.  A thread local flag keeps an allocation made by backtrace
+    itself (which loads libgcc the first time) from being sampled in turn.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "sfmm.h"
+
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+typedef struct sf_profile_stack {
+    uint64_t hash; // 0 while the entry is unused
+    int depth;
+    void *frames[PROFILE_MAX_DEPTH];
+    size_t alloc_count; // sampled allocations made from this stack
+    size_t alloc_bytes;
+    size_t live_count; // those not freed yet
+    size_t live_bytes;
+} sf_profile_stack;
+
+typedef struct sf_profile_sample {
+    void *payload; // NULL while the slot is empty
+    sf_profile_stack *stack;
+    size_t size; // the size that was asked for
+} sf_profile_sample;
+
+size_t sf_profile_rate; // mean bytes allocated between samples, 0 while profiling is off
+
+static sf_profile_stack *stack_table; // PROFILE_MAX_STACKS entries, open addressing by hash
+static sf_profile_sample *sample_table; // PROFILE_MAX_SAMPLES entries, open addressing by address
+static size_t sample_count; // entries of sample_table in use
+static size_t profile_rate_dumped; // the rate the samples were taken at, for the dump header
+
+static SF_THREAD_LOCAL size_t bytes_until_sample;
+static SF_THREAD_LOCAL uint64_t sample_random;
+static SF_THREAD_LOCAL int in_profiler;
+
+#ifdef SF_THREADS
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+    Draws the number of bytes until the next sample from an exponential distribution with mean rate.
+*/
+static size_t next_sample_interval(size_t rate) {
+    if (sample_random == 0) sample_random = ((uintptr_t)&sample_random >> 4) * 0x9E3779B97F4A7C15ULL | 1;
+    sample_random ^= sample_random << 13; // xorshift64
+    sample_random ^= sample_random >> 7;
+    sample_random ^= sample_random << 17;
+
+    double uniform = (double)((sample_random >> 11) + 1) / 9007199254740992.0; // in (0, 1]
+    double interval = -log(uniform) * (double)rate;
+    if (interval < 1) return 1;
+    if (interval > (double)(SIZE_MAX / 2)) return SIZE_MAX / 2;
+    return (size_t)interval;
+}
+
+/*
+    Counts size bytes against the calling thread's sampling interval.  Returns 1 if this allocation
+    is to be sampled.
+*/
+int profile_sample_due(size_t size) {
+    size_t rate = sf_profile_rate;
+    if (rate == 0 || in_profiler) return 0;
+
+    if (bytes_until_sample == 0) bytes_until_sample = next_sample_interval(rate); // the thread's first allocation
+    if (bytes_until_sample > size) {
+        bytes_until_sample -= size;
+        return 0;
+    }
+
+    bytes_until_sample = next_sample_interval(rate);
+    return !region_is_active();
+}
+
+static uint64_t hash_frames(void **frames, int depth) {
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a over the return addresses
+    for (int i = 0; i < depth; i++) {
+        hash ^= (uint64_t)(uintptr_t)frames[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/*
+    Returns the entry of the stack, adding it if it is new, or NULL if the table is full.
+    The profile lock is held.
+*/
+static sf_profile_stack *find_stack(void **frames, int depth) {
+    uint64_t hash = hash_frames(frames, depth);
+    for (size_t probe = 0; probe < PROFILE_MAX_STACKS; probe++) {
+        sf_profile_stack *stack = &stack_table[(hash + probe) & (PROFILE_MAX_STACKS - 1)];
+        if (stack->hash == 0) {
+            stack->hash = hash;
+            stack->depth = depth;
+            memcpy(stack->frames, frames, depth * sizeof(void *));
+            return stack;
+        }
+        if (stack->hash == hash && stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(void *)) == 0) {
+            return stack;
+        }
+    }
+    return NULL;
+}
+
+static size_t sample_slot(void *payload) {
+    return (size_t)(((uintptr_t)payload >> 5) * 0x9E3779B97F4A7C15ULL >> 32) & (PROFILE_MAX_SAMPLES - 1);
+}
+
+/*
+    Records the allocation at payload, of size bytes, as a sample taken from its caller's caller.
+    Called by the public entry points right after the allocation, so the two innermost frames are
+    this function and the entry point.  Payloads without a block header (slab objects) are skipped.
+*/
+__attribute__((noinline)) void profile_record(void *payload, size_t size) {
+    if (slab_lookup(payload) != NULL) return;
+
+    in_profiler = 1;
+    void *frames[PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES];
+    int depth = backtrace(frames, PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES) - PROFILE_SKIP_FRAMES;
+    if (depth < 0) depth = 0;
+
+    SF_LOCK(profile_lock);
+    sf_profile_stack *stack = (stack_table != NULL) ? find_stack(frames + PROFILE_SKIP_FRAMES, depth) : NULL;
+    if (stack != NULL && sample_count < PROFILE_MAX_SAMPLES / 4 * 3) { // probes stay short and always find a hole
+        size_t slot = sample_slot(payload);
+        while (sample_table[slot].payload != NULL) slot = (slot + 1) & (PROFILE_MAX_SAMPLES - 1);
+
+        sample_table[slot].payload = payload;
+        sample_table[slot].stack = stack;
+        sample_table[slot].size = size;
+        sample_count++;
+        stack->alloc_count++;
+        stack->alloc_bytes += size;
+        stack->live_count++;
+        stack->live_bytes += size;
+        set_sampled_bit((sf_block *)((char *)payload - sizeof(sf_header)), 1);
+    }
+    SF_UNLOCK(profile_lock);
+    in_profiler = 0;
+}
+
+/*
+    Called on the way out of every block with SAMPLED_BLOCK set, before its header is rewritten:
+    clears the bit and takes the sample out of the live bytes of its stack.
+*/
+void profile_retire_block(sf_block *block) {
+    void *payload = (char *)block + sizeof(sf_header);
+    set_sampled_bit(block, 0);
+
+    SF_LOCK(profile_lock);
+    size_t mask = PROFILE_MAX_SAMPLES - 1;
+    size_t slot = sample_slot(payload);
+    while (sample_table[slot].payload != NULL && sample_table[slot].payload != payload) slot = (slot + 1) & mask;
+
+    if (sample_table[slot].payload == payload) {
+        sf_profile_sample *sample = &sample_table[slot];
+        sample->stack->live_count--;
+        sample->stack->live_bytes -= sample->size;
+        sample->payload = NULL;
+        sample_count--;
+
+        // Shift the samples after the hole back so every one is still reachable from its slot
+        size_t hole = slot;
+        for (size_t next = (slot + 1) & mask; sample_table[next].payload != NULL; next = (next + 1) & mask) {
+            size_t home = sample_slot(sample_table[next].payload);
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                sample_table[hole] = sample_table[next];
+                sample_table[next].payload = NULL;
+                hole = next;
+            }
+        }
+    }
+    SF_UNLOCK(profile_lock);
+}
+
+/*
+    sf_mallopt(SF_OPT_PROFILE_RATE, rate).  Maps the tables the first time profiling is turned on.
+    Returns 0 with sf_errno set to ENOMEM if they can't be mapped.
+*/
+int profile_set_rate(size_t rate) {
+    if (rate != 0) {
+        SF_LOCK(profile_lock);
+        if (stack_table == NULL) {
+            size_t stacks_size = PROFILE_MAX_STACKS * sizeof(sf_profile_stack);
+            size_t samples_size = PROFILE_MAX_SAMPLES * sizeof(sf_profile_sample);
+            char *tables = mmap(NULL, stacks_size + samples_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (tables == MAP_FAILED) {
+                SF_UNLOCK(profile_lock);
+                sf_errno = ENOMEM;
+                return 0;
+            }
+            sample_table = (sf_profile_sample *)(tables + stacks_size);
+            stack_table = (sf_profile_stack *)tables;
+        }
+        profile_rate_dumped = rate;
+        SF_UNLOCK(profile_lock);
+
+        void *frame;
+        in_profiler = 1;
+        backtrace(&frame, 1); // loads libgcc now rather than in the middle of the first sample
+        in_profiler = 0;
+    }
+    sf_profile_rate = rate;
+    return 1;
+}
+
+static int write_all(int fd, const char *text, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, text, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        text += written;
+        length -= (size_t)written;
+    }
+    return 1;
+}
+
+int sf_profile_dump(int fd) {
+    if (stack_table == NULL) { // profiling was never turned on
+        sf_errno = EINVAL;
+        return 0;
+    }
+
+    char line[64 + PROFILE_MAX_DEPTH * 20];
+    int ok = 1;
+
+    SF_LOCK(profile_lock);
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < PROFILE_MAX_STACKS; i++) {
+        live_count += stack_table[i].live_count;
+        live_bytes += stack_table[i].live_bytes;
+        alloc_count += stack_table[i].alloc_count;
+        alloc_bytes += stack_table[i].alloc_bytes;
+    }
+    int length = snprintf(line, sizeof(line), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                          live_count, live_bytes, alloc_count, alloc_bytes, profile_rate_dumped);
+    ok = write_all(fd, line, (size_t)length);
+
+    for (size_t i = 0; i < PROFILE_MAX_STACKS && ok; i++) {
+        sf_profile_stack *stack = &stack_table[i];
+        if (stack->hash == 0) continue;
+
+        length = snprintf(line, sizeof(line), "%zu: %zu [%zu: %zu] @",
+                          stack->live_count, stack->live_bytes, stack->alloc_count, stack->alloc_bytes);
+        for (int frame = 0; frame < stack->depth; frame++) {
+            length += snprintf(line + length, sizeof(line) - length, " %p", stack->frames[frame]);
+        }
+        line[length++] = '\n';
+        ok = write_all(fd, line, (size_t)length);
+    }
+    SF_UNLOCK(profile_lock);
+
+    // pprof needs the mappings to symbolize the addresses
+    if (ok) ok = write_all(fd, "\nMAPPED_LIBRARIES:\n", 19);
+    int maps = ok ? open("/proc/self/maps", O_RDONLY) : -1;
+    if (maps >= 0) {
+        ssize_t count;
+        while (ok && (count = read(maps, line, sizeof(line))) > 0) ok = write_all(fd, line, (size_t)count);
+        close(maps);
+    }
+
+    if (!ok) {
+        sf_errno = errno;
+        return 0;
+    }
+    return 1;
+}
+
+#ifdef SF_THREADS
+/*
+    Takes (lock 1) or releases (lock 0) the profile lock, for lock_heap_for_fork.
+*/
+void profile_fork_lock(int lock) {
+    if (lock) {
+        pthread_mutex_lock(&profile_lock);
+    } else {
+        pthread_mutex_unlock(&profile_lock);
+    }
+}
+#endif
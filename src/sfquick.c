@@ -0,0 +1,116 @@
+/*
+    Quick lists for deferred coalescing (SF_OPT_DEFER_COALESCE).
+
+    When the mode is on, a freed block of up to QUICK_MAX_SIZE bytes is not coalesced.  It is pushed
+    onto the quick list for its exact size, and the next request for that size pops it again, so a
+    program that keeps freeing and allocating the same sizes never merges and re-splits them.  Like
+    the thread cache, quick blocks keep their allocated bit (plus CACHED_BLOCK): neighbors never
+    coalesce into them and check_pointer rejects a second free.
+
+    The deferred blocks are coalesced all at once by quick_consolidate, when a free list search
+    misses (before the heap is grown) and when the bytes on the quick lists pass sf_quick_limit.
+    Unlike the thread cache the quick lists are shared by all threads, behind a single lock.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+size_t sf_quick_limit; // bytes the quick lists may hold before they are consolidated, 0 while the mode is off
+
+static sf_block *quick_lists[QUICK_NUM_LISTS]; // singly linked through body.links.next
+static size_t quick_bytes;
+
+#ifdef SF_THREADS
+static pthread_mutex_t quick_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int quick_list_index(size_t size_align) {
+    return (int)(size_align / MIN_BLOCK_SIZE) - 1;
+}
+
+/*
+    Parks a validated allocated block of size_align bytes on its quick list, and consolidates all of
+    them if that puts the quick lists over sf_quick_limit.
+*/
+void quick_put_block(sf_block *block, size_t size_align) {
+    int index = quick_list_index(size_align);
+
+    SF_LOCK(quick_lock);
+    set_cached_bit(block, 1);
+    block->body.links.next = quick_lists[index];
+    quick_lists[index] = block;
+    quick_bytes += size_align;
+    int over_limit = quick_bytes > sf_quick_limit;
+    SF_UNLOCK(quick_lock);
+
+    if (over_limit) quick_consolidate();
+}
+
+/*
+    Returns the most recently freed quick block of exactly size_align bytes, or NULL if there is none.
+*/
+sf_block *quick_get_block(size_t size_align) {
+    int index = quick_list_index(size_align);
+
+    SF_LOCK(quick_lock);
+    sf_block *block = quick_lists[index];
+    if (block != NULL) {
+        quick_lists[index] = block->body.links.next;
+        quick_bytes -= size_align;
+        set_cached_bit(block, 0);
+    }
+    SF_UNLOCK(quick_lock);
+    return block;
+}
+
+/*
+    Frees every block on the quick lists for real, coalescing each one with its neighbors.  The lists
+    are emptied under the lock and the blocks released after it is dropped.  Returns 1 if there was
+    anything to consolidate, 0 if the quick lists were empty.
+*/
+int quick_consolidate(void) {
+    if (__atomic_load_n(&quick_bytes, __ATOMIC_RELAXED) == 0) return 0;
+
+    sf_block *deferred = NULL;
+    SF_LOCK(quick_lock);
+    for (int index = 0; index < QUICK_NUM_LISTS; index++) {
+        while (quick_lists[index] != NULL) {
+            sf_block *block = quick_lists[index];
+            quick_lists[index] = block->body.links.next;
+            block->body.links.next = deferred;
+            deferred = block;
+        }
+    }
+    quick_bytes = 0;
+    SF_UNLOCK(quick_lock);
+
+    if (deferred == NULL) return 0; // another thread consolidated first
+
+    while (deferred != NULL) {
+        sf_block *next_deferred = deferred->body.links.next;
+        set_cached_bit(deferred, 0);
+        release_block_to_heap(deferred);
+        deferred = next_deferred;
+    }
+    return 1;
+}
+
+#ifdef SF_THREADS
+/*
+    Takes (lock 1) or releases (lock 0) the quick list lock, for lock_heap_for_fork.
+*/
+void quick_fork_lock(int lock) {
+    if (lock) {
+        pthread_mutex_lock(&quick_lock);
+    } else {
+        pthread_mutex_unlock(&quick_lock);
+    }
+}
+#endif
@@ -0,0 +1,229 @@
+/*
+    Regions: mark the heap, allocate, and give back everything allocated since the mark at once.
+
+    Taking the outermost mark claims the wilderness, the free block in front of the epilogue, by
+    taking it off its free list and marking it allocated.  From then on every sf_malloc, sf_realloc
+    and sf_memalign is served by cutting blocks off the front of that reserved block (bumping
+    region_top), growing the heap behind it when it runs out.  The blocks have ordinary headers, so
+    check_pointer accepts them, but they never go on a free list and never coalesce:
+
+        region_base ... region_top        blocks handed out since the outermost mark
+        region_top ... epilogue           what is left of the wilderness, one reserved block
+
+    A mark is just a position between region_base and region_top.  Releasing it writes a single
+    reserved block from that position to the epilogue, which drops every block above it without
+    looking at any of them; releasing the outermost mark then frees that block into the heap like
+    any other, so the wilderness is what it was before the region started (or bigger).
+
+    While a region is held the heap grows only for the region: allocations that don't go through it
+    (slab pages, arena chunks, tcache refills) are served from the free lists below region_base and
+    fail with ENOMEM instead of growing the heap.  All region state is protected by sf_grow_lock.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+static char *region_base; // first byte of the outermost region, NULL while no region is held
+static char *region_top; // header of the next block to hand out
+static size_t region_depth; // marks held
+static size_t region_allocated; // bytes of the blocks handed out since the outermost mark
+
+int region_is_active(void) {
+    return __atomic_load_n(&region_base, __ATOMIC_RELAXED) != NULL;
+}
+
+/*
+    Returns 1 if block was handed out by the region that is currently held.  Such blocks are only
+    given back by sf_region_release, so sf_free leaves them alone.
+*/
+int region_owns_block(sf_block *block) {
+    char *base = __atomic_load_n(&region_base, __ATOMIC_RELAXED);
+    return base != NULL && (char *)block >= base && (void *)block < heap_mem_end();
+}
+
+static sf_block *region_epilogue(void) {
+    return (sf_block *)((char *)heap_mem_end() - EPILOGUE_SIZE);
+}
+
+/*
+    Takes the free block in front of the epilogue off its free list and marks it allocated.
+    Returns it, or the epilogue itself if the last block of the heap is allocated.  The caller must
+    hold sf_grow_lock; sf_trim uses it too.
+*/
+sf_block *claim_wilderness(void) {
+#ifdef SF_THREADS
+    return claim_wilderness_locked();
+#endif
+    sf_block *epilogue = region_epilogue();
+    if (get_prev_alloc_bit(epilogue)) return epilogue;
+
+    sf_footer *wilderness_footer = (sf_footer *)((char *)epilogue - sizeof(sf_footer));
+    sf_block *wilderness = (sf_block *)((char *)epilogue - (*wilderness_footer & ~0x1F));
+    remove_from_free_list(wilderness);
+
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(wilderness)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    write_claimed_block_header(wilderness, get_block_size(wilderness), prev_bit);
+    set_prev_alloc_bit(epilogue, 1);
+    return wilderness;
+}
+
+/*
+    Rewrites the header at region_top as one reserved block reaching up to the epilogue.  The block
+    in front of region_top may be freed by another thread at the same time, which flips the prev
+    alloc bit of this header, so it is rewritten under its stripe.
+*/
+static void reserve_rest_of_heap(void) {
+    sf_block *rest = (sf_block *)region_top;
+    size_t rest_size = (char *)region_epilogue() - region_top;
+    if (rest_size == 0) return; // region_top is the epilogue
+
+#ifdef SF_THREADS
+    lock_block_tags(rest);
+#endif
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(rest)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    write_claimed_block_header(rest, rest_size, prev_bit);
+#ifdef SF_THREADS
+    unlock_block_tags(rest);
+#endif
+}
+
+/*
+    Grows the heap so at least missing more bytes are reserved for the region.  The old epilogue
+    becomes part of the reserved block.  Returns 0 with sf_errno set to ENOMEM if not a single page
+    could be added.
+*/
+static int region_grow(size_t missing) {
+    size_t npages = growth_pages_with_ramp(missing);
+    size_t pages_grown = 0;
+    while (pages_grown < npages && heap_mem_grow() != NULL) {
+        pages_grown++;
+    }
+    if (pages_grown == 0) {
+        sf_errno = ENOMEM;
+        return 0;
+    }
+    stat_record_heap_growth();
+
+    write_block_header(region_epilogue(), 0, 1, 1);
+    reserve_rest_of_heap();
+    return 1;
+}
+
+/*
+    Cuts a block of size_align bytes whose payload is a multiple of align off the front of the
+    reserved block.  The space skipped to reach the alignment becomes an allocated filler block that
+    is never handed out.  Returns NULL with sf_errno set to ENOMEM if the heap can't hold the block.
+*/
+sf_block *region_allocate_block(size_t size_align, size_t align) {
+    SF_LOCK(sf_grow_lock);
+    if (region_base == NULL) { // released by another thread after the caller looked
+        SF_UNLOCK(sf_grow_lock);
+        return allocate_aligned_block_from_heap(size_align, align);
+    }
+
+    uintptr_t payload = (uintptr_t)region_top + sizeof(sf_header);
+    size_t filler_size = (align - (payload & (align - 1))) & (align - 1); // a multiple of 32, so 0 or a whole block
+    size_t needed = filler_size + size_align;
+
+    size_t rest_size = (char *)region_epilogue() - region_top;
+    while (rest_size < needed) {
+        if (!region_grow(needed - rest_size)) {
+            SF_UNLOCK(sf_grow_lock);
+            return NULL;
+        }
+        rest_size = (char *)region_epilogue() - region_top;
+    }
+
+    sf_block *block = (sf_block *)region_top;
+#ifdef SF_THREADS
+    lock_block_tags(block);
+#endif
+    int prev_bit = 0;
+    if (get_prev_alloc_bit(block)) {
+        // means previous bit is allocated set to 1
+        prev_bit = 1;
+    }
+    if (filler_size > 0) {
+        write_claimed_block_header(block, filler_size, prev_bit);
+        block = get_block_end(block);
+        prev_bit = 1;
+    }
+    write_block_header(block, size_align, prev_bit, 1);
+#ifdef SF_THREADS
+    unlock_block_tags((sf_block *)region_top);
+#endif
+
+    // Nobody else can reach the header after the new block until the block is handed out
+    region_top += needed;
+    region_allocated += size_align;
+    if (rest_size > needed) write_claimed_block_header((sf_block *)region_top, rest_size - needed, 1);
+
+    SF_UNLOCK(sf_grow_lock);
+    return block;
+}
+
+int sf_region_begin(sf_region_mark *mark) {
+    if (mark == NULL) {
+        sf_errno = EINVAL;
+        return 0;
+    }
+    if (!check_initialized_heap()) return 0;
+
+    SF_LOCK(sf_grow_lock);
+    if (region_depth == 0) {
+        region_top = (char *)claim_wilderness();
+        region_allocated = 0;
+        __atomic_store_n(&region_base, region_top, __ATOMIC_RELAXED);
+    }
+    region_depth++;
+
+    mark->position = region_top;
+    mark->depth = region_depth;
+    mark->allocated = region_allocated;
+    SF_UNLOCK(sf_grow_lock);
+    return 1;
+}
+
+int sf_region_release(const sf_region_mark *mark) {
+    if (mark == NULL) {
+        sf_errno = EINVAL;
+        return 0;
+    }
+
+    SF_LOCK(sf_grow_lock);
+    if (mark->depth == 0 || mark->depth > region_depth ||
+        (char *)mark->position < region_base || (char *)mark->position > region_top) {
+        SF_UNLOCK(sf_grow_lock); // not a mark of the region that is held, or already released
+        sf_errno = EINVAL;
+        return 0;
+    }
+
+    SF_STAT_SUB(live_bytes, region_allocated - mark->allocated);
+    region_allocated = mark->allocated;
+    region_depth = mark->depth - 1;
+    region_top = mark->position;
+    reserve_rest_of_heap();
+
+    if (region_depth == 0) {
+        __atomic_store_n(&region_base, NULL, __ATOMIC_RELAXED);
+        if (region_top != (char *)region_epilogue()) release_block_to_heap((sf_block *)region_top);
+        region_top = NULL;
+    }
+    SF_UNLOCK(sf_grow_lock);
+    return 1;
+}
@@ -0,0 +1,280 @@
+/*
+    Slab layer for small requests, in front of the free lists.
+
+    A slab is one ordinary allocated block of SLAB_BLOCK_SIZE bytes taken from the heap.  Its payload
+    starts with an sf_slab descriptor and the rest is cut into objects of a single size (32, 64 or 96
+    bytes).  Objects have no header or footer and are never coalesced: a bit in the slab's free_objects
+    map says whether each one is free, so allocating is a find-first-set and freeing sets a bit.
+
+    sf_free and sf_realloc need to know whether a pointer is a slab object before they look for a
+    block header in front of it.  slab_page_map records, for every PAGE_SZ page of the heap, the slab
+    (if any) that starts in that page.  Slabs are exactly one page long, so at most one starts in a
+    page and an object can only belong to the slab starting in its own page or in the page before.
+    Both candidates are checked by address alone, without reading the slab, so a lookup is safe even
+    if a neighboring slab is being torn down at the same time.  The map only covers the first
+    SLAB_PAGE_MAP_PAGES pages of the heap.  Once a new slab lands past them, slab_page_map_full is
+    set and small requests are served from ordinary blocks without trying again, until a slab is
+    given back (which frees a page the map covers) or the heap is small enough for the map again.
+
+    Slabs of a class that still have free objects are kept on a doubly linked list.  A slab that
+    becomes completely free is given back to the heap unless it is the only one left in its class.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+static sf_slab *slab_partial[SLAB_NUM_CLASSES]; // slabs of each class with at least one free object
+static sf_slab *slab_page_map[SLAB_PAGE_MAP_PAGES];
+static int slab_count; // slabs in use, so sf_free can skip the lookup when there are none
+static int slab_page_map_full; // the last new slab landed past the pages the map covers
+
+#ifdef SF_THREADS
+static pthread_mutex_t slab_locks[SLAB_NUM_CLASSES] = {
+    [0 ... SLAB_NUM_CLASSES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+#endif
+
+static int slab_class_index(size_t size) {
+    return (int)((size - 1) / SLAB_OBJECT_UNIT);
+}
+
+static size_t slab_object_size(int class_index) {
+    return (size_t)(class_index + 1) * SLAB_OBJECT_UNIT;
+}
+
+static char *slab_objects(sf_slab *slab) {
+    return (char *)slab + sizeof(sf_slab);
+}
+
+static sf_block *slab_block(sf_slab *slab) {
+    return (sf_block *)((char *)slab - sizeof(sf_header));
+}
+
+static void slab_list_push(sf_slab *slab) {
+    sf_slab **head = &slab_partial[slab->class_index];
+
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_remove(sf_slab *slab) {
+    if (slab->prev != NULL) slab->prev->next = slab->next;
+    else slab_partial[slab->class_index] = slab->next;
+    if (slab->next != NULL) slab->next->prev = slab->prev;
+
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static size_t slab_page_index(void *address) {
+    return (size_t)((char *)address - (char *)heap_mem_start()) / PAGE_SZ;
+}
+
+/*
+    Takes a new slab block from the heap and cuts it into objects of the given class.
+    Returns NULL (with sf_errno set by the heap) if there is no memory, and also (with sf_errno
+    untouched, and slab_page_map_full set) if the block lands past the part of the heap the page
+    map covers.
+*/
+static sf_slab *slab_create(int class_index) {
+    sf_block *block = allocate_block_from_heap(SLAB_BLOCK_SIZE);
+    if (block == NULL) return NULL;
+
+    sf_slab *slab = (sf_slab *)((char *)block + sizeof(sf_header));
+    size_t page = slab_page_index(slab);
+    if (page >= SLAB_PAGE_MAP_PAGES) {
+        __atomic_store_n(&slab_page_map_full, 1, __ATOMIC_RELAXED);
+        release_block_to_heap(block);
+        return NULL;
+    }
+
+    size_t object_count = (SLAB_BLOCK_SIZE - sizeof(sf_header) - sizeof(sf_slab)) / slab_object_size(class_index);
+    if (object_count > SLAB_MAX_OBJECTS) object_count = SLAB_MAX_OBJECTS;
+
+    slab->class_index = class_index;
+    slab->object_count = (unsigned int)object_count;
+    slab->free_objects = (object_count == SLAB_MAX_OBJECTS) ? ~(uint64_t)0 : ((uint64_t)1 << object_count) - 1;
+    slab_list_push(slab);
+
+    __atomic_store_n(&slab_page_map[page], slab, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&slab_count, 1, __ATOMIC_RELAXED);
+    return slab;
+}
+
+static void slab_destroy(sf_slab *slab) {
+    slab_list_remove(slab);
+    __atomic_store_n(&slab_page_map[slab_page_index(slab)], NULL, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&slab_count, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slab_page_map_full, 0, __ATOMIC_RELAXED); // the next slab may fit in its page
+
+    release_block_to_heap(slab_block(slab));
+}
+
+/*
+    Returns the slab holding ptr, or NULL if ptr isn't inside any slab.  Only addresses are
+    compared, the slab descriptors themselves are not read.
+*/
+sf_slab *slab_lookup(void *ptr) {
+    if (__atomic_load_n(&slab_count, __ATOMIC_RELAXED) == 0) return NULL;
+    if (ptr < heap_mem_start() || ptr >= heap_mem_end()) return NULL;
+
+    size_t page = slab_page_index(ptr);
+    for (int back = 0; back <= 1 && back <= (int)page; back++) {
+        if (page - back >= SLAB_PAGE_MAP_PAGES) continue;
+
+        sf_slab *slab = __atomic_load_n(&slab_page_map[page - back], __ATOMIC_ACQUIRE);
+        if (slab == NULL) continue;
+
+        char *objects_end = (char *)slab_block(slab) + SLAB_BLOCK_SIZE;
+        if ((char *)ptr >= slab_objects(slab) && (char *)ptr < objects_end) return slab;
+    }
+    return NULL;
+}
+
+/*
+    Returns 1 if a new slab is known to land past the part of the heap the page map covers, so
+    that taking a block for it would only be undone again.
+*/
+static int slab_page_map_exhausted(void) {
+    if (!__atomic_load_n(&slab_page_map_full, __ATOMIC_RELAXED)) return 0;
+    return (size_t)((char *)heap_mem_end() - (char *)heap_mem_start()) > (size_t)SLAB_PAGE_MAP_PAGES * PAGE_SZ;
+}
+
+/*
+    Returns a free object big enough for size bytes (1 to SLAB_MAX_SIZE), creating a new slab
+    for the class if every slab in it is full.  If no slab can be made, because the heap has no
+    room for one or the only room is past the part of the heap the page map covers, the request
+    gets an ordinary block instead, and NULL is returned only if there is no room for that either.
+*/
+void *slab_alloc(size_t size) {
+    int class_index = slab_class_index(size);
+
+    SF_LOCK(slab_locks[class_index]);
+    sf_slab *slab = slab_partial[class_index];
+    if (slab == NULL && !slab_page_map_exhausted()) slab = slab_create(class_index);
+    if (slab == NULL) {
+        SF_UNLOCK(slab_locks[class_index]);
+        sf_errno = 0;
+        return allocate_block_payload(size);
+    }
+
+    int object = __builtin_ctzll(slab->free_objects);
+    slab->free_objects &= ~((uint64_t)1 << object);
+    if (slab->free_objects == 0) slab_list_remove(slab); // full, nothing left to hand out
+
+    SF_UNLOCK(slab_locks[class_index]);
+
+    stat_record_allocation(size, slab_object_size(class_index));
+    return slab_objects(slab) + object * slab_object_size(class_index);
+}
+
+/*
+    Returns 1 if ptr is the start of an object of the slab that is currently handed out.
+*/
+static int slab_object_in_use(sf_slab *slab, void *ptr) {
+    size_t offset = (char *)ptr - slab_objects(slab);
+    size_t object = offset / slab_object_size(slab->class_index);
+
+    if (offset % slab_object_size(slab->class_index) != 0 || object >= slab->object_count) return 0;
+    return !(slab->free_objects & ((uint64_t)1 << object));
+}
+
+/*
+    Gives an object back to its slab.  A pointer into the middle of an object or to an object
+    that is already free is an invalid free and aborts, the same as in sf_free.
+*/
+void slab_free(sf_slab *slab, void *ptr) {
+    int class_index = slab->class_index;
+    size_t offset = (char *)ptr - slab_objects(slab);
+
+    SF_LOCK(slab_locks[class_index]);
+    if (!slab_object_in_use(slab, ptr)) {
+        SF_UNLOCK(slab_locks[class_index]);
+        sf_errno = EINVAL;
+        abort();
+    }
+
+    size_t object = offset / slab_object_size(class_index);
+    int was_full = (slab->free_objects == 0);
+    slab->free_objects |= (uint64_t)1 << object;
+    if (was_full) slab_list_push(slab);
+    SF_STAT_SUB(live_bytes, slab_object_size(class_index));
+
+    // Keep one empty slab per class around so a class that drains and refills doesn't thrash the heap
+    int all_free = (slab->object_count == SLAB_MAX_OBJECTS) ? slab->free_objects == ~(uint64_t)0
+                                                            : slab->free_objects == ((uint64_t)1 << slab->object_count) - 1;
+    if (all_free && (slab->next != NULL || slab->prev != NULL)) {
+        slab_destroy(slab);
+    }
+    SF_UNLOCK(slab_locks[class_index]);
+}
+
+#ifdef SF_THREADS
+/*
+    Takes (lock 1) or releases (lock 0) every slab lock, for lock_heap_for_fork.  A slab lock is
+    held while the slab layer allocates from the heap, so these come before the heap's own locks.
+*/
+void slab_fork_locks(int lock) {
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        if (lock) {
+            pthread_mutex_lock(&slab_locks[i]);
+        } else {
+            pthread_mutex_unlock(&slab_locks[SLAB_NUM_CLASSES - 1 - i]);
+        }
+    }
+}
+#endif
+
+/*
+    Returns the size of the objects of the slab, all of which the caller may use.
+*/
+size_t slab_usable_size(sf_slab *slab) {
+    return slab_object_size(slab->class_index);
+}
+
+/*
+    sf_realloc for slab objects: the object is kept if size still fits in it, otherwise the data
+    is moved to a new allocation (which may or may not be a slab object).  An invalid pointer sets
+    sf_errno to EINVAL and returns NULL, as sf_realloc does for blocks.
+*/
+void *slab_realloc(sf_slab *slab, void *ptr, size_t size) {
+    size_t object_size = slab_object_size(slab->class_index);
+
+    SF_LOCK(slab_locks[slab->class_index]);
+    int in_use = slab_object_in_use(slab, ptr);
+    SF_UNLOCK(slab_locks[slab->class_index]);
+    if (!in_use) {
+        sf_errno = EINVAL;
+        return NULL;
+    }
+
+    if (size == 0) {
+        slab_free(slab, ptr);
+        return NULL;
+    }
+    if (size <= object_size) {
+        SF_STAT_SUB(live_bytes, object_size);
+        stat_record_allocation(size, object_size);
+        return ptr;
+    }
+
+    void *larger = allocate_payload(size);
+    if (larger == NULL) {
+        SF_STAT_ADD(failed_allocations, 1);
+        return NULL;
+    }
+
+    memcpy(larger, ptr, object_size);
+    slab_free(slab, ptr);
+    return larger;
+}
@@ -0,0 +1,128 @@
+/*
+    Allocation statistics for sf_get_stats.
+
+    The counters are bumped on every call, so they have to stay cheap.  In SF_THREADS builds a
+    single set of counters would be one cache line that every thread writes on every call, so
+    instead each thread is given one of STAT_SLOTS slots the first time it counts something and
+    only ever adds to that one.  Threads sharing a slot add atomically; sf_get_stats adds all the
+    slots up.
+
+    The heap size gauges change only while the heap grows, under sf_grow_lock, so they are kept
+    as plain globals.  The free memory gauges are not kept at all: sf_get_stats walks the free
+    lists when it is asked for them.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+static sf_stat_counters stat_slots[STAT_SLOTS];
+static size_t stat_heap_grows;
+static size_t stat_peak_heap_size;
+
+#ifdef SF_THREADS
+static int stat_next_slot;
+static SF_THREAD_LOCAL sf_stat_counters *stat_thread_slot;
+
+sf_stat_counters *stat_slot(void) {
+    if (stat_thread_slot == NULL) {
+        int slot = __atomic_fetch_add(&stat_next_slot, 1, __ATOMIC_RELAXED) & (STAT_SLOTS - 1);
+        stat_thread_slot = &stat_slots[slot];
+    }
+    return stat_thread_slot;
+}
+#else
+sf_stat_counters *stat_slot(void) {
+    return &stat_slots[0];
+}
+#endif
+
+/*
+    Records one successful allocation: requested is what the caller asked for and allocated is
+    the size of the block or slab object it got.
+*/
+void stat_record_allocation(size_t requested, size_t allocated) {
+    SF_STAT_ADD(bytes_requested, requested);
+    SF_STAT_ADD(bytes_allocated, allocated);
+    SF_STAT_ADD(live_bytes, allocated);
+}
+
+/*
+    Called after every heap_mem_grow that the heap keeps, with sf_grow_lock held.
+*/
+void stat_record_heap_growth(void) {
+    size_t heap_size = heap_mem_end() - heap_mem_start();
+
+    stat_heap_grows++;
+    if (heap_size > stat_peak_heap_size) stat_peak_heap_size = heap_size;
+}
+
+static size_t stat_load(size_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/*
+    Adds up the sizes of the blocks on every free list.  Each list is walked under its own lock,
+    so the totals of different lists may be from slightly different moments.
+*/
+static void stat_walk_free_lists(sf_stats *stats) {
+    stats->free_list_count = sf_num_free_lists;
+    if (heap_mem_start() == heap_mem_end()) return; // no heap, so the free lists aren't set up yet
+
+    for (int index = 0; index < sf_num_free_lists; index++) {
+        sf_block *free_list_head = &sf_default_lists.heads[index];
+
+        SF_LOCK(sf_free_list_locks[index]);
+        for (sf_block *block = free_list_head->body.links.next; block != free_list_head; block = block->body.links.next) {
+            size_t block_size = get_block_size(block);
+
+            stats->free_bytes_per_class[index] += block_size;
+            stats->free_bytes += block_size;
+            stats->free_blocks++;
+            if (block_size > stats->largest_free_block) stats->largest_free_block = block_size;
+        }
+        SF_UNLOCK(sf_free_list_locks[index]);
+    }
+}
+
+int sf_get_stats(sf_stats *stats) {
+    if (stats == NULL) {
+        sf_errno = EINVAL;
+        return 0;
+    }
+    memset(stats, 0, sizeof(sf_stats));
+
+    for (int slot = 0; slot < STAT_SLOTS; slot++) {
+        sf_stat_counters *counters = &stat_slots[slot];
+
+        stats->malloc_calls += stat_load(&counters->malloc_calls);
+        stats->free_calls += stat_load(&counters->free_calls);
+        stats->realloc_calls += stat_load(&counters->realloc_calls);
+        stats->memalign_calls += stat_load(&counters->memalign_calls);
+        stats->calloc_calls += stat_load(&counters->calloc_calls);
+        stats->failed_allocations += stat_load(&counters->failed_allocations);
+        stats->bytes_requested += stat_load(&counters->bytes_requested);
+        stats->bytes_allocated += stat_load(&counters->bytes_allocated);
+        stats->live_bytes += stat_load(&counters->live_bytes);
+        stats->coalesces += stat_load(&counters->coalesces);
+        stats->splits += stat_load(&counters->splits);
+        stats->mapped_bytes += stat_load(&counters->mapped_bytes);
+        stats->mapped_blocks += stat_load(&counters->mapped_blocks);
+        stats->trimmed_bytes += stat_load(&counters->trimmed_bytes);
+    }
+
+    SF_LOCK(sf_grow_lock);
+    stats->heap_size = heap_mem_end() - heap_mem_start();
+    stats->peak_heap_size = stat_peak_heap_size;
+    stats->heap_grows = stat_heap_grows;
+    SF_UNLOCK(sf_grow_lock);
+
+    stat_walk_free_lists(stats);
+    return 1;
+}
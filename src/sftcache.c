@@ -0,0 +1,160 @@
+/*
+    Per-thread cache of small blocks in front of sf_malloc and sf_free.
+
+    Each thread owns TCACHE_NUM_BINS bins, one for every block size from MIN_BLOCK_SIZE up to
+    TCACHE_MAX_SIZE (the sizes held by the first four Fibonacci free lists).  A bin is a singly
+    linked LIFO stack threaded through body.links.next of the cached blocks.
+
+    Cached blocks keep their allocated bit set (plus CACHED_BLOCK) so the rest of the heap treats
+    them as in use: neighbors never coalesce into them and check_pointer rejects a second free.
+    When a bin runs dry it is refilled with a batch of blocks taken from the shared free lists,
+    and when it fills up half of it is flushed back.  Everything in between touches only
+    thread-local memory and takes no locks.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+typedef struct tcache_bin {
+    sf_block *head;
+    int count;
+} tcache_bin;
+
+static SF_THREAD_LOCAL tcache_bin tcache_bins[TCACHE_NUM_BINS];
+
+#ifdef SF_THREADS
+/*
+    A thread that exits with blocks still cached would leak them, so the first time a thread
+    uses its cache it registers a destructor that flushes everything back to the heap.
+*/
+static pthread_key_t tcache_exit_key;
+static pthread_once_t tcache_exit_key_once = PTHREAD_ONCE_INIT;
+static SF_THREAD_LOCAL int tcache_registered;
+
+static void tcache_thread_exit(void *unused) {
+    (void)unused;
+    sf_tcache_flush();
+}
+
+static void tcache_create_exit_key(void) {
+    pthread_key_create(&tcache_exit_key, tcache_thread_exit);
+}
+
+static void tcache_register_thread(void) {
+    if (tcache_registered) return;
+    pthread_once(&tcache_exit_key_once, tcache_create_exit_key);
+    pthread_setspecific(tcache_exit_key, &tcache_registered); // any non-NULL value runs the destructor
+    tcache_registered = 1;
+}
+#else
+static void tcache_register_thread(void) {
+}
+#endif
+
+static int tcache_bin_index(size_t size_align) {
+    return (int)(size_align / MIN_BLOCK_SIZE) - 1;
+}
+
+static void tcache_push(tcache_bin *bin, sf_block *block) {
+    set_cached_bit(block, 1);
+    block->body.links.next = bin->head;
+    bin->head = block;
+    bin->count++;
+}
+
+static sf_block *tcache_pop(tcache_bin *bin) {
+    sf_block *block = bin->head;
+    bin->head = block->body.links.next;
+    bin->count--;
+    set_cached_bit(block, 0);
+    return block;
+}
+
+/*
+    Takes a batch of blocks of exactly size_align bytes from the shared free lists.  Only the
+    first block may grow the heap, the rest of the batch is taken from memory that is already
+    free so a refill never causes extra heap growth.
+*/
+static int tcache_refill(tcache_bin *bin, size_t size_align) {
+    sf_block *block = allocate_block_from_heap(size_align);
+    if (block == NULL) return 0;
+    tcache_push(bin, block);
+
+    for (int i = 1; i < TCACHE_REFILL_BATCH; i++) {
+        sf_block *free_block = take_free_block(size_align);
+        if (free_block == NULL) break;
+
+        tcache_push(bin, free_block);
+    }
+
+    return 1;
+}
+
+/*
+    Returns a cached block of size_align bytes, refilling the bin from the heap if it is empty.
+    Returns NULL with sf_errno set to ENOMEM if the heap can't supply a block.
+*/
+sf_block *tcache_get_block(size_t size_align) {
+    tcache_bin *bin = &tcache_bins[tcache_bin_index(size_align)];
+
+    if (bin->head == NULL) {
+        tcache_register_thread();
+        if (!tcache_refill(bin, size_align)) return NULL;
+    }
+
+    return tcache_pop(bin);
+}
+
+/*
+    Parks a validated allocated block of size_align bytes in the calling thread's cache.  If the bin
+    is full, the older half of it is flushed to the shared free lists first.  Always returns 1.
+*/
+int tcache_put_block(sf_block *block, size_t size_align) {
+    tcache_bin *bin = &tcache_bins[tcache_bin_index(size_align)];
+
+    if ((size_t)bin->count >= sf_tcache_count) {
+        tcache_flush_bin(tcache_bin_index(size_align), (int)(sf_tcache_count / 2));
+    }
+
+    tcache_register_thread();
+    tcache_push(bin, block);
+    return 1;
+}
+
+/*
+    Releases all but the first keep blocks of a bin back to the shared free lists, coalescing
+    each of them.  The blocks kept are the most recently freed.
+*/
+void tcache_flush_bin(int bin_index, int keep) {
+    tcache_bin *bin = &tcache_bins[bin_index];
+    if (bin->count <= keep) return;
+
+    // Walk past the blocks that stay and cut the list there
+    sf_block **cut = &bin->head;
+    for (int i = 0; i < keep; i++) {
+        cut = &(*cut)->body.links.next;
+    }
+    sf_block *flushed = *cut;
+    *cut = NULL;
+    bin->count = keep;
+
+    while (flushed != NULL) {
+        sf_block *next_cached = flushed->body.links.next;
+        set_cached_bit(flushed, 0);
+        release_block_to_heap(flushed);
+        flushed = next_cached;
+    }
+}
+
+void sf_tcache_flush(void) {
+    for (int bin_index = 0; bin_index < TCACHE_NUM_BINS; bin_index++) {
+        tcache_flush_bin(bin_index, 0);
+    }
+}
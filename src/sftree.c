@@ -0,0 +1,141 @@
+/*
+    Index of the large free blocks.
+
+    The last free list holds every block bigger than the bound of the list before it, so on its own
+    it is one unordered LIFO list that a large request has to scan.  Its blocks are therefore also
+    kept in a search tree ordered by (size, address): the smallest block of at least a given size,
+    the lowest addressed one among equal sizes, is found in O(log n), which gives best fit for large
+    requests.  The blocks stay on the list too, so everything that walks the free lists still sees
+    them; only the search for a block to take goes through the tree.
+
+    The tree is a treap: it is a binary search tree by (size, address) and a heap by a priority
+    hashed from the block address, which keeps it balanced with high probability without storing
+    anything but the two child pointers.  They live in the payload of the free block, right after
+    its list links (large blocks are always big enough for them).
+
+    Tree nodes are keyed by the size in their header, so a block must be taken out of the tree
+    before its header is rewritten, which is already the rule for taking it off its list.
+*/
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+typedef struct sf_tree_links {
+    sf_block *left;
+    sf_block *right;
+} sf_tree_links;
+
+static sf_tree_links *tree_links(sf_block *block) {
+    return (sf_tree_links *)((char *)block + sizeof(sf_header) + sizeof(block->body.links));
+}
+
+static uint64_t tree_priority(sf_block *block) {
+    return (uint64_t)((uintptr_t)block >> 5) * 0x9E3779B97F4A7C15ULL; // Fibonacci hashing spreads nearby addresses
+}
+
+/*
+    Returns 1 if the key (size, address) orders before the block node.
+*/
+static int tree_key_before(size_t size, uintptr_t address, sf_block *node) {
+    size_t node_size = get_block_size(node);
+    return size < node_size || (size == node_size && address < (uintptr_t)node);
+}
+
+static void tree_rotate_right(sf_block **root) {
+    sf_block *left = tree_links(*root)->left;
+    tree_links(*root)->left = tree_links(left)->right;
+    tree_links(left)->right = *root;
+    *root = left;
+}
+
+static void tree_rotate_left(sf_block **root) {
+    sf_block *right = tree_links(*root)->right;
+    tree_links(*root)->right = tree_links(right)->left;
+    tree_links(right)->left = *root;
+    *root = right;
+}
+
+void tree_insert(sf_block **root, sf_block *block) {
+    if (*root == NULL) {
+        tree_links(block)->left = NULL;
+        tree_links(block)->right = NULL;
+        *root = block;
+        return;
+    }
+
+    if (tree_key_before(get_block_size(block), (uintptr_t)block, *root)) {
+        tree_insert(&tree_links(*root)->left, block);
+        if (tree_priority(tree_links(*root)->left) > tree_priority(*root)) tree_rotate_right(root);
+    } else {
+        tree_insert(&tree_links(*root)->right, block);
+        if (tree_priority(tree_links(*root)->right) > tree_priority(*root)) tree_rotate_left(root);
+    }
+}
+
+/*
+    Takes block out of the tree: it is rotated down, always towards the child with the higher
+    priority, until it has at most one child, which then takes its place.
+*/
+void tree_remove(sf_block **root, sf_block *block) {
+    sf_block *node = *root;
+    if (node == NULL) return; // not in the tree
+
+    if (node != block) {
+        if (tree_key_before(get_block_size(block), (uintptr_t)block, node)) tree_remove(&tree_links(node)->left, block);
+        else tree_remove(&tree_links(node)->right, block);
+        return;
+    }
+
+    sf_block *left = tree_links(node)->left;
+    sf_block *right = tree_links(node)->right;
+    if (left == NULL) {
+        *root = right;
+    } else if (right == NULL) {
+        *root = left;
+    } else if (tree_priority(left) > tree_priority(right)) {
+        tree_rotate_right(root);
+        tree_remove(&tree_links(*root)->right, block);
+    } else {
+        tree_rotate_left(root);
+        tree_remove(&tree_links(*root)->left, block);
+    }
+}
+
+/*
+    Returns the first block in (size, address) order that is not before the key, or NULL.
+*/
+static sf_block *tree_ceiling(sf_block *root, size_t size, uintptr_t address) {
+    sf_block *found = NULL;
+    sf_block *node = root;
+    while (node != NULL) {
+        size_t node_size = get_block_size(node);
+        if (node_size < size || (node_size == size && (uintptr_t)node < address)) {
+            node = tree_links(node)->right; // node is before the key
+        } else {
+            found = node;
+            node = tree_links(node)->left;
+        }
+    }
+    return found;
+}
+
+/*
+    Best fit: the smallest block of at least size bytes, and of those the one at the lowest address.
+*/
+sf_block *tree_best_fit(sf_block *root, size_t size) {
+    return tree_ceiling(root, size, 0);
+}
+
+/*
+    The block after block in (size, address) order, for trying the next best fit.
+*/
+sf_block *tree_next_block(sf_block *root, sf_block *block) {
+    return tree_ceiling(root, get_block_size(block), (uintptr_t)block + 1);
+}
@@ -0,0 +1,130 @@
+/*
+    Heap trimming: giving the pages of the free tail of the heap back to the system.
+
+    The heap only ever grows: heap_mem_grow has no inverse, so the end of the heap can't move back
+    once a burst of allocations has pushed it out.  What can go back is the memory behind the addresses.
+    The free block in front of the epilogue (the wilderness) is taken off its free list, the whole
+    pages inside it are released with madvise(MADV_DONTNEED), and the block is freed again.  Its
+    header, links and footer stay where they are, so the block is still an ordinary free block of
+    the same size; only its pages are gone from the resident set, and they come back, zero filled,
+    when an allocation touches them again.
+
+    sf_trim does this on request.  With SF_OPT_TRIM_THRESHOLD set, a free that leaves more than
+    that many resident bytes in the wilderness does it automatically.  trim_released_start tracks
+    where the released pages begin, so the same pages are not released over and over: the bytes
+    of the wilderness below it are the only ones counted as resident.  A freed block that reaches
+    past it was handed out from the released pages, so they count as resident again.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // madvise
+#endif
+
+#include "sfmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "errno.h"
+
+#include "test_header.h"
+
+size_t sf_trim_threshold; // resident wilderness bytes a free may leave before it trims, 0 while automatic trims are off
+
+static char *trim_released_start; // first released page of the wilderness, NULL if none is
+
+/*
+    Returns the size of the wilderness, or 0 if the last block of the heap is allocated (or there
+    is no heap), and stores where it starts in start.  Without sf_grow_lock this is only a hint:
+    the block may be taken at any time, so only its footer is read and the size is checked to be
+    within the heap before anything uses it.
+*/
+static size_t peek_wilderness(char **start) {
+    if (heap_mem_start() == heap_mem_end()) return 0;
+
+    sf_block *epilogue = (sf_block *)((char *)heap_mem_end() - EPILOGUE_SIZE);
+    if (get_prev_alloc_bit(epilogue)) return 0;
+
+    sf_footer *wilderness_footer = (sf_footer *)((char *)epilogue - sizeof(sf_footer));
+    size_t size = *wilderness_footer & ~0x1F;
+    if (size == 0 || size > (size_t)((char *)epilogue - (char *)heap_mem_start())) return 0;
+
+    *start = (char *)epilogue - size;
+    return size;
+}
+
+/*
+    Releases the whole pages of a claimed wilderness block past its first keep_bytes, leaving the
+    page with its header and free list links and the page with its footer alone.  Returns the
+    number of bytes released.
+*/
+static size_t release_wilderness_pages(sf_block *wilderness, size_t keep_bytes) {
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t block_end = (uintptr_t)wilderness + get_block_size(wilderness);
+    size_t kept = sizeof(sf_header) + 4 * sizeof(sf_block *); // header, list links and tree links
+    if (keep_bytes > get_block_size(wilderness) - kept) return 0;
+
+    uintptr_t start = ((uintptr_t)wilderness + kept + keep_bytes + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = (block_end - sizeof(sf_footer)) & ~(page_size - 1);
+    if (start >= end) return 0;
+
+    if (madvise((void *)start, end - start, MADV_DONTNEED) != 0) return 0;
+    __atomic_store_n(&trim_released_start, (char *)start, __ATOMIC_RELAXED);
+    SF_STAT_ADD(trimmed_bytes, end - start);
+    return end - start;
+}
+
+/*
+    Trims the wilderness down to keep_bytes resident bytes.  Nothing is trimmed while a region is
+    held, since the wilderness then belongs to the region, nor when the page provider's memory
+    can't be released.  Returns the number of bytes released.
+*/
+static size_t trim_heap(size_t keep_bytes) {
+    if (region_is_active() || !heap_pages_releasable()) return 0;
+
+    SF_LOCK(sf_grow_lock);
+    size_t released = 0;
+    if (heap_mem_start() != heap_mem_end() && !region_is_active()) {
+        sf_block *wilderness = claim_wilderness();
+        if (get_block_size(wilderness) != 0) { // not the epilogue
+            released = release_wilderness_pages(wilderness, keep_bytes);
+            release_block_to_heap(wilderness);
+        }
+    }
+    SF_UNLOCK(sf_grow_lock);
+    return released;
+}
+
+/*
+    Called after the block of block_size bytes at block_freed is freed: trims the heap if the free
+    left more than sf_trim_threshold resident bytes in the wilderness.
+*/
+void trim_if_due(sf_block *block_freed, size_t block_size) {
+    size_t threshold = sf_trim_threshold;
+    if (threshold == 0) return;
+
+    char *released_start = __atomic_load_n(&trim_released_start, __ATOMIC_RELAXED);
+    if (released_start != NULL && (char *)block_freed + block_size > released_start) {
+        released_start = NULL; // the released pages were allocated since
+        __atomic_store_n(&trim_released_start, NULL, __ATOMIC_RELAXED);
+    }
+
+    char *wilderness;
+    size_t wilderness_size = peek_wilderness(&wilderness);
+    if (wilderness_size <= threshold) return;
+
+    // The pages from trim_released_start on were released and not touched since, unless the
+    // wilderness has since been allocated past them
+    char *resident_end = wilderness + wilderness_size;
+    if (released_start != NULL && released_start > wilderness && released_start < resident_end) {
+        resident_end = released_start;
+    }
+    if ((size_t)(resident_end - wilderness) > threshold) trim_heap(0);
+}
+
+int sf_trim(size_t keep_bytes) {
+    return trim_heap(keep_bytes) != 0;
+}
@@ -1,6 +1,8 @@
 #include <criterion/criterion.h>
 #include <errno.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "debug.h"
 #include "sfmm.h"
 #define TEST_TIMEOUT 15
@@ -499,4 +501,768 @@ Test(sfmm_student_suite, student_test_6, .timeout = TEST_TIMEOUT) {
     assert_free_block_count(1984, 1);  // After freeing, all should coalesce into a single block
 
     cr_assert(sf_errno == 0, "sf_errno is not zero!");
-}
\ No newline at end of file
+}
+Test(sfmm_student_suite, student_test_10, .timeout = TEST_TIMEOUT) {
+    // small blocks freed with the thread cache on stay out of the free lists until flushed
+    sf_errno = 0;
+    sf_mallopt(SF_OPT_TCACHE, 1);
+
+    void *x = sf_malloc(20); // refills the 32 byte bin with a batch of 8 blocks
+    cr_assert_not_null(x, "x is NULL!");
+    assert_free_block_count(0, 1);
+    assert_free_block_count(1728, 1);
+
+    sf_free(x);
+    assert_free_block_count(0, 1); // x went to the cache, not to a free list
+
+    void *y = sf_malloc(10);
+    cr_assert(x == y, "Cache did not hand back the most recently freed block!");
+
+    sf_tcache_flush();
+
+    // The 7 cached blocks in front of y coalesce into one block
+    assert_free_block_count(0, 2);
+    assert_free_block_count(224, 1);
+    assert_free_block_count(1728, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_11, .timeout = TEST_TIMEOUT, .signal = SIGABRT) {
+    // freeing a block that is already parked in the thread cache is a double free
+    sf_mallopt(SF_OPT_FREE_CHECK, 1); // make fast checks only every 64th free
+    sf_mallopt(SF_OPT_TCACHE, 1);
+
+    void *x = sf_malloc(40);
+    sf_free(x);
+    sf_free(x);
+}
+
+Test(sfmm_student_suite, student_test_12, .timeout = TEST_TIMEOUT) {
+    // the bitmap of non-empty free lists follows the lists as blocks are freed and allocated
+    sf_errno = 0;
+    void *a = sf_malloc(24);  // 32, list 0
+    void *s = sf_malloc(24);  // keeps a and b from coalescing
+    void *b = sf_malloc(100); // 128, list 3
+    void *c = sf_malloc(24);
+    void *d = sf_malloc(200); // 224, list 4
+    void *e = sf_malloc(24);
+    cr_assert_not_null(e, "e is NULL!");
+
+    sf_free(a);
+    sf_free(b);
+    sf_free(d);
+    cr_assert_eq(sf_free_list_bitmap, FREE_LIST_BIT(0) | FREE_LIST_BIT(3) | FREE_LIST_BIT(4) | FREE_LIST_BIT(NUM_FREE_LISTS - 1),
+                 "Wrong free list bitmap after frees!");
+
+    void *x = sf_malloc(120); // exact match for b empties list 3
+    cr_assert(x == b, "Exact match was not used!");
+
+    void *y = sf_malloc(400); // 416, list 5 is empty so it is split off the wilderness
+    cr_assert_not_null(y, "y is NULL!");
+    cr_assert_eq(sf_free_list_bitmap, FREE_LIST_BIT(0) | FREE_LIST_BIT(4) | FREE_LIST_BIT(7), // the 1088 byte wilderness drops to list 7
+                 "Wrong free list bitmap after mallocs!");
+
+    assert_free_block_count(0, 3);
+    assert_free_block_count(224, 1);
+    assert_free_block_count(1088, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+    (void)s;
+    (void)c;
+}
+
+Test(sfmm_student_suite, student_test_13, .timeout = TEST_TIMEOUT) {
+    // the size class table puts each size in the same Fibonacci list the bounds say it belongs to
+    sf_free(sf_malloc(1)); // the table is built when the heap is initialized
+
+    size_t bounds[NUM_FREE_LISTS - 1] = {1, 2, 3, 5, 8, 13, 21, 34};
+    for (int index = 0; index < NUM_FREE_LISTS - 1; index++) {
+        size_t bound = bounds[index] * MIN_BLOCK_SIZE;
+        cr_assert_eq(get_free_list_index(bound), index, "Wrong list for size %ld", bound);
+        cr_assert_eq(get_free_list_index(bound + 1), index + 1, "Wrong list for size %ld", bound + 1);
+    }
+    cr_assert_eq(get_free_list_index(100352), NUM_FREE_LISTS - 1, "Large size not in the last list");
+}
+
+Test(sfmm_student_suite, student_test_14, .timeout = TEST_TIMEOUT) {
+    // back to back heap growths ramp up: the first adds the one page needed, the next adds two
+    sf_errno = 0;
+    void *x = sf_malloc(1900); // 1920 of the 1984 byte first block
+    void *y = sf_malloc(100);  // 128 needs 64 more bytes, one page
+    cr_assert(sf_mem_start() + 2 * PAGE_SZ == sf_mem_end(), "First growth was not one page!");
+
+    void *z = sf_malloc(2000); // 2016 needs 32 more bytes, but the ramp adds two pages
+    cr_assert_not_null(z, "z is NULL!");
+    cr_assert(sf_mem_start() + 4 * PAGE_SZ == sf_mem_end(), "Second growth was not two pages!");
+
+    assert_free_block_count(0, 1);
+    assert_free_block_count(4064, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+    (void)x;
+    (void)y;
+}
+
+Test(sfmm_student_suite, student_test_15, .timeout = TEST_TIMEOUT) {
+    // realloc to a larger size absorbs the free block after it instead of moving
+    sf_errno = 0;
+    void *x = sf_malloc(40);  // 64
+    void *y = sf_malloc(200); // 224
+    void *z = sf_malloc(8);   // keeps y from coalescing with the wilderness
+    memset(x, 0xAB, 40);
+    sf_free(y);
+
+    void *w = sf_realloc(x, 200);
+    cr_assert(w == x, "Realloc moved the block instead of growing it in place!");
+    cr_assert(((unsigned char *)w)[39] == 0xAB, "Realloc lost the payload!");
+
+    sf_block *bp = (sf_block *)((char *)w - 8);
+    cr_assert((bp->header & ~0x1f) == 224, "Block size (%ld) not what was expected (%ld)!", bp->header & ~0x1f, 224);
+
+    assert_free_block_count(0, 2);
+    assert_free_block_count(64, 1); // the rest of y is split off again
+    assert_free_block_count(1664, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+    (void)z;
+}
+
+Test(sfmm_student_suite, student_test_16, .timeout = TEST_TIMEOUT) {
+    // realloc of the last block grows the heap under it, and realloc to 0 frees
+    sf_errno = 0;
+    void *x = sf_malloc(1900); // 1920, followed by the 64 byte wilderness
+
+    void *y = sf_realloc(x, 4000); // 4032 = the 1984 bytes left in the first page + one new page
+    cr_assert(y == x, "Realloc moved the last block instead of growing the heap!");
+    cr_assert(sf_mem_start() + 2 * PAGE_SZ == sf_mem_end(), "Heap did not grow by exactly one page!");
+    assert_free_block_count(0, 0);
+
+    cr_assert_null(sf_realloc(y, 0), "Realloc to 0 did not return NULL!");
+    assert_free_block_count(0, 1);
+    assert_free_block_count(4032, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_17, .timeout = TEST_TIMEOUT) {
+    // with slabs on, small requests are packed into one slab block without headers
+    sf_errno = 0;
+    sf_mallopt(SF_OPT_SLAB, 1);
+
+    char *x = sf_malloc(1);
+    char *y = sf_malloc(20);
+    cr_assert_not_null(x, "x is NULL!");
+    cr_assert(y == x + 32, "Objects of the same class are not packed next to each other!");
+    cr_assert(((uintptr_t)x & 31) == 0, "Slab object is not 32 byte aligned!");
+
+    // The slab is a single page-sized block; the heap grew by one page to make room for it
+    assert_free_block_count(0, 1);
+    assert_free_block_count(1984, 1);
+
+    sf_free(x);
+    sf_free(y);
+    assert_free_block_count(0, 1); // the last slab of a class is kept even when it is empty
+
+    char *z = sf_malloc(30);
+    cr_assert(z == x, "Freed slab object was not reused!");
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_18, .timeout = TEST_TIMEOUT, .signal = SIGABRT) {
+    // freeing a slab object twice is caught by its slab's bitmap
+    sf_mallopt(SF_OPT_SLAB, 1);
+
+    void *x = sf_malloc(64);
+    sf_free(x);
+    sf_free(x);
+}
+
+Test(sfmm_student_suite, student_test_19, .timeout = TEST_TIMEOUT) {
+    // sf_get_stats counts calls and bytes and reports the free lists as they are
+    sf_errno = 0;
+    sf_stats stats;
+    void *x = sf_malloc(100);  // 128
+    void *y = sf_malloc(1000); // 1024, leaves 832 of the first page free
+    sf_free(x);
+
+    cr_assert(sf_get_stats(&stats) == 1, "sf_get_stats failed!");
+    cr_assert(stats.malloc_calls == 2 && stats.free_calls == 1, "Wrong number of calls counted!");
+    cr_assert(stats.bytes_requested == 1100, "Requested bytes (%ld) not what was expected (%ld)!", stats.bytes_requested, 1100);
+    cr_assert(stats.bytes_allocated == 1152, "Allocated bytes (%ld) not what was expected (%ld)!", stats.bytes_allocated, 1152);
+    cr_assert(stats.live_bytes == 1024, "Live bytes (%ld) not what was expected (%ld)!", stats.live_bytes, 1024);
+    cr_assert(stats.free_blocks == 2 && stats.free_bytes == 960, "Free lists not reported correctly!");
+    cr_assert(stats.largest_free_block == 832, "Largest free block (%ld) not what was expected (%ld)!", stats.largest_free_block, 832);
+    cr_assert(stats.heap_grows == 1 && stats.peak_heap_size == PAGE_SZ, "Heap growth not reported correctly!");
+    cr_assert(stats.splits == 2 && stats.coalesces == 0, "Wrong number of splits or coalesces counted!");
+
+    sf_free(y); // merges with the free blocks on both sides
+    sf_get_stats(&stats);
+    cr_assert(stats.live_bytes == 0, "Live bytes (%ld) not what was expected (%ld)!", stats.live_bytes, 0);
+    cr_assert(stats.coalesces == 2, "Coalesces (%ld) not what was expected (%ld)!", stats.coalesces, 2);
+    cr_assert(stats.free_blocks == 1 && stats.largest_free_block == 1984, "Free lists not reported correctly!");
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+
+    cr_assert(sf_get_stats(NULL) == 0 && sf_errno == EINVAL, "sf_get_stats(NULL) did not fail with EINVAL!");
+}
+
+Test(sfmm_student_suite, student_test_20, .timeout = TEST_TIMEOUT) {
+    // memalign carves the aligned block out of a free block: nothing but the block itself stays allocated
+    sf_errno = 0;
+    sf_stats stats;
+
+    void *x = sf_memalign(100, 4096); // 128
+    cr_assert_not_null(x, "x is NULL!");
+    cr_assert(((uintptr_t)x & (4096 - 1)) == 0, "Returned address is not 4096-byte aligned!");
+
+    sf_block *bp = (sf_block *)((char *)x - 8);
+    cr_assert((bp->header & ~0x1f) == 128, "Block size (%ld) not what was expected (%ld)!", bp->header & ~0x1f, 128);
+
+    // The prologue and padding take 56 bytes and the epilogue 8, everything else is x or free
+    sf_get_stats(&stats);
+    cr_assert(stats.free_bytes + 128 == stats.heap_size - 64, "Memory around the aligned block was lost!");
+    cr_assert(stats.heap_size <= 3 * PAGE_SZ, "Heap grew by more than an aligned fit needs!");
+
+    sf_free(x);
+    assert_free_block_count(0, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_21, .timeout = TEST_TIMEOUT) {
+    // arena blocks come from the arena's own chunk and never show up on the default free lists
+    sf_errno = 0;
+    sf_stats stats;
+    sf_arena *arena = sf_arena_create();
+    cr_assert_not_null(arena, "arena is NULL!");
+
+    void *x = sf_arena_malloc(arena, 100);
+    void *y = sf_arena_memalign(arena, 200, 256);
+    void *z = sf_malloc(100);
+    cr_assert(x != NULL && y != NULL && z != NULL, "An allocation failed!");
+    cr_assert(((uintptr_t)y & (256 - 1)) == 0, "Returned address is not 256-byte aligned!");
+
+    sf_arena_free(arena, x);
+    sf_arena_free(arena, y);
+    for (int index = 0; index < NUM_FREE_LISTS; index++) {
+        sf_block *free_list_head = &sf_free_list_heads[index];
+        for (sf_block *block = free_list_head->body.links.next; block != free_list_head; block = block->body.links.next) {
+            cr_assert((void *)block != (char *)x - 8 && (void *)block != (char *)y - 8,
+                      "An arena block was put on a default free list!");
+        }
+    }
+
+    x = sf_arena_realloc(arena, sf_arena_malloc(arena, 40), 400);
+    cr_assert_not_null(x, "x is NULL!");
+
+    // z, the arena and its chunk are live in the default heap
+    sf_get_stats(&stats);
+    cr_assert(stats.live_bytes > 128 + ARENA_MIN_CHUNK_SIZE, "Wrong live bytes %zu with an arena!", stats.live_bytes);
+
+    // destroying the arena gives back its chunk and the arena itself
+    sf_arena_destroy(arena);
+    sf_get_stats(&stats);
+    cr_assert(stats.live_bytes == 128, "Wrong live bytes %zu after the arena was destroyed!", stats.live_bytes);
+    sf_free(z);
+    assert_free_block_count(0, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_22, .timeout = TEST_TIMEOUT) {
+    // releasing a mark gives back everything allocated since it without freeing each block
+    sf_errno = 0;
+    sf_stats stats;
+    sf_region_mark outer, inner;
+
+    void *x = sf_malloc(100); // allocated before the region, freed as usual while it is held
+    cr_assert(sf_region_begin(&outer) == 1, "sf_region_begin failed!");
+
+    void *y = sf_malloc(200);
+    void *z = sf_memalign(50, 512);
+    cr_assert(y != NULL && z != NULL, "An allocation failed!");
+    cr_assert(((uintptr_t)z & (512 - 1)) == 0, "Returned address is not 512-byte aligned!");
+    cr_assert((char *)z > (char *)y, "Region blocks are not handed out in address order!");
+    sf_free(y); // does nothing until the region is released
+
+    cr_assert(sf_region_begin(&inner) == 1, "sf_region_begin failed!");
+    void *w = sf_malloc(3000); // more than the first page has left, so the heap grows for the region
+    cr_assert_not_null(w, "w is NULL!");
+    cr_assert(sf_region_release(&inner) == 1, "sf_region_release failed!");
+    cr_assert(sf_malloc(3000) == w, "Released memory was not handed out again!");
+
+    sf_free(x);
+    cr_assert(sf_region_release(&outer) == 1, "sf_region_release failed!");
+    cr_assert(sf_region_release(&inner) == 0 && sf_errno == EINVAL, "A released mark was released again!");
+
+    sf_get_stats(&stats);
+    cr_assert(stats.live_bytes == 0, "Live bytes (%ld) not what was expected (%ld)!", stats.live_bytes, 0);
+    assert_free_block_count(0, 1);
+}
+
+Test(sfmm_student_suite, student_test_23, .timeout = TEST_TIMEOUT) {
+    // a batch is cut from one free block, and freeing it in any order leaves one free block again
+    sf_errno = 0;
+    sf_stats stats;
+    void *ptrs[8];
+
+    cr_assert(sf_malloc_batch(100, 8, ptrs) == 8, "Not every block of the batch was allocated!");
+    for (int i = 1; i < 8; i++) {
+        cr_assert((char *)ptrs[i] == (char *)ptrs[i - 1] + 128, "Batch blocks are not next to each other!");
+    }
+    void *x = sf_malloc(100); // keeps the batch away from the wilderness
+
+    void *shuffled[8] = {ptrs[5], ptrs[0], ptrs[7], ptrs[2], ptrs[6], ptrs[1], ptrs[4], ptrs[3]};
+    sf_free_batch(shuffled, 8);
+    assert_free_block_count(1024, 1);
+
+    sf_get_stats(&stats);
+    cr_assert(stats.malloc_calls == 9 && stats.free_calls == 8, "Wrong number of calls counted!");
+    cr_assert(stats.live_bytes == 128, "Live bytes (%ld) not what was expected (%ld)!", stats.live_bytes, 128);
+
+    sf_free(x);
+    assert_free_block_count(0, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_24, .timeout = TEST_TIMEOUT) {
+    // sf_free_sized frees like sf_free, checked or not
+    sf_errno = 0;
+    void *x = sf_malloc(100);
+    void *y = sf_malloc(1000);
+    void *z = sf_malloc(64);
+
+    sf_free_sized(x, 100);
+    assert_free_block_count(128, 1);
+
+    cr_assert(sf_mallopt(SF_OPT_FREE_CHECK, 0) == 1, "sf_mallopt failed!");
+    sf_free_sized(y, 1000);
+    sf_free(z);
+    assert_free_block_count(0, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_25, .timeout = TEST_TIMEOUT, .signal = SIGABRT) {
+    // a checked sized free with a size that doesn't match the block aborts
+    sf_mallopt(SF_OPT_FREE_CHECK, 1);
+    void *x = sf_malloc(100);
+    sf_free_sized(x, 1000);
+}
+
+Test(sfmm_student_suite, student_test_26, .timeout = TEST_TIMEOUT) {
+    // deferred blocks are reused as they are, and merged only when a search misses
+    sf_errno = 0;
+    sf_stats stats;
+    cr_assert(sf_mallopt(SF_OPT_DEFER_COALESCE, 4096) == 1, "sf_mallopt failed!");
+
+    void *x = sf_malloc(100);
+    void *y = sf_malloc(100);
+    sf_free(x);
+    sf_free(y);
+    assert_free_block_count(0, 1); // only the wilderness, x and y are waiting unmerged
+
+    cr_assert(sf_malloc(100) == y, "The last block freed was not handed out again!");
+    sf_free(y);
+
+    // 1824 bytes don't fit in the wilderness alone, but do once x and y are merged into it
+    void *z = sf_malloc(1800);
+    cr_assert(z == x, "The deferred blocks were not merged on a miss!");
+    sf_get_stats(&stats);
+    cr_assert(stats.heap_size == PAGE_SZ, "The heap grew instead of merging the deferred blocks!");
+
+    sf_free(z);
+    sf_mallopt(SF_OPT_DEFER_COALESCE, 0);
+    assert_free_block_count(0, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_27, .timeout = TEST_TIMEOUT) {
+    // large requests take the best fit, the lowest addressed one among equal sizes
+    sf_errno = 0;
+    sf_stats stats;
+
+    void *a = sf_malloc(2000); // 2016 bytes
+    sf_malloc(8);
+    void *b = sf_malloc(1300); // 1312 bytes
+    sf_malloc(8);
+    void *c = sf_malloc(1500); // 1536 bytes
+    sf_malloc(8);
+    void *d = sf_malloc(1300); // 1312 bytes
+    sf_malloc(8);
+
+    // use up the wilderness so it can't be the best fit
+    sf_get_stats(&stats);
+    cr_assert(stats.free_blocks == 1, "There should be only the wilderness left!");
+    void *w = sf_malloc(stats.free_bytes - sizeof(sf_header));
+    cr_assert_not_null(w, "The wilderness could not be allocated!");
+
+    // freed in this order, a is at the head of the last free list and first fit would split it
+    sf_free(b);
+    sf_free(c);
+    sf_free(d);
+    sf_free(a);
+
+    void *x = sf_malloc(1200);
+    cr_assert(x == b, "The best fitting block was not used!");
+    assert_free_block_count(96, 1); // what was left of b
+    assert_free_block_count(1312, 1);
+    assert_free_block_count(1536, 1);
+    assert_free_block_count(2016, 1);
+
+    cr_assert(sf_malloc(1300) == d, "The exact fit was not used!");
+    cr_assert(sf_malloc(1400) == c, "The best fitting block was not used!");
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_28, .timeout = TEST_TIMEOUT) {
+    // the quarter step scheme has 4 classes per power of two, and can't be changed once the heap exists
+    sf_errno = 0;
+    sf_stats stats;
+    cr_assert(sf_mallopt(SF_OPT_SIZE_CLASSES, SF_CLASSES_QUARTER) == 1, "sf_mallopt failed!");
+
+    void *x = sf_malloc(1300); // 1312 bytes
+    sf_malloc(8);
+    sf_free(x);
+
+    cr_assert_eq(sf_num_free_lists, 57, "Wrong number of size classes");
+    cr_assert_eq(get_free_list_index(128), 3, "Wrong list for size 128");
+    cr_assert_eq(get_free_list_index(160), 4, "Wrong list for size 160");
+    cr_assert_eq(get_free_list_index(1280), 16, "Wrong list for size 1280");
+    cr_assert_eq(get_free_list_index(1312), 17, "Wrong list for size 1312");
+    cr_assert_eq(get_free_list_index(1536), 17, "Wrong list for size 1536");
+    cr_assert_eq(get_free_list_index(1537), 18, "Wrong list for size 1537");
+    cr_assert_eq(get_free_list_index(1 << 20), 55, "Wrong list for size 1MB");
+    cr_assert_eq(get_free_list_index((1 << 20) + 1), 56, "Wrong list for size over 1MB");
+
+    cr_assert(sf_free_list_bitmap & FREE_LIST_BIT(17), "The freed block is not in its quarter step list!");
+    sf_block *head = &sf_default_lists.heads[17];
+    cr_assert(head->body.links.next != head && get_block_size(head->body.links.next) == 1312,
+              "The freed block is not in its quarter step list!");
+
+    sf_get_stats(&stats);
+    cr_assert_eq(stats.free_list_count, 57, "Wrong number of free lists in the stats");
+    cr_assert_eq(stats.free_bytes_per_class[17], 1312, "Wrong free bytes in list 17");
+
+    cr_assert(sf_mallopt(SF_OPT_SIZE_CLASSES, SF_CLASSES_FIBONACCI) == 0, "The scheme changed after the first allocation!");
+    cr_assert(sf_errno == EINVAL, "sf_errno is not EINVAL!");
+}
+
+Test(sfmm_student_suite, student_test_29, .timeout = TEST_TIMEOUT) {
+    // blocks past the mmap threshold are mapped outside the heap and unmapped when freed
+    sf_errno = 0;
+    sf_stats stats;
+
+    char *x = sf_malloc(200000);
+    cr_assert_not_null(x, "A large block could not be allocated!");
+    cr_assert(((uintptr_t)x & 31) == 0, "The mapped payload is not aligned!");
+    cr_assert((void *)x < sf_mem_start() || (void *)x >= sf_mem_end(), "The large block is in the heap!");
+    memset(x, 'a', 200000);
+
+    sf_get_stats(&stats);
+    cr_assert_eq(stats.mapped_blocks, 1, "Wrong number of mapped blocks");
+    cr_assert(stats.mapped_bytes >= 200000, "Too few bytes mapped");
+    cr_assert(stats.heap_size <= PAGE_SZ, "The heap grew for a mapped block!");
+
+    x = sf_realloc(x, 400000);
+    cr_assert_not_null(x, "The mapped block could not grow!");
+    cr_assert(x[0] == 'a' && x[199999] == 'a', "The data was not kept when the mapping grew!");
+
+    // shrunk below the threshold, it moves into the heap
+    x = sf_realloc(x, 1000);
+    cr_assert_not_null(x, "The mapped block could not shrink!");
+    cr_assert((void *)x >= sf_mem_start() && (void *)x < sf_mem_end(), "The small block was not moved into the heap!");
+    cr_assert(x[0] == 'a' && x[999] == 'a', "The data was not kept when the block moved into the heap!");
+    sf_get_stats(&stats);
+    cr_assert_eq(stats.mapped_bytes, 0, "The mapping was not released");
+
+    void *y = sf_memalign(150000, 8192);
+    cr_assert(y != NULL && ((uintptr_t)y & 8191) == 0, "The mapped block is not aligned!");
+    sf_free(y);
+    sf_free(x);
+
+    sf_get_stats(&stats);
+    cr_assert(stats.mapped_bytes == 0 && stats.mapped_blocks == 0, "The mappings were not released");
+    cr_assert_eq(stats.live_bytes, 0, "Live bytes left after freeing everything");
+
+    // with the threshold off they are heap requests again, which can't fit
+    cr_assert(sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0) == 1, "sf_mallopt failed!");
+    cr_assert_null(sf_malloc(200000), "A block bigger than the heap was allocated!");
+    cr_assert(sf_errno == ENOMEM, "sf_errno is not ENOMEM!");
+}
+
+Test(sfmm_student_suite, student_test_30, .timeout = TEST_TIMEOUT) {
+    // trimming releases the pages of the free tail of the heap, which stays usable
+    sf_errno = 0;
+    sf_stats stats;
+
+    char *x = sf_malloc(90000);
+    memset(x, 'x', 90000);
+    sf_free(x);
+    cr_assert(sf_trim(0) == 1, "Nothing was trimmed!");
+    sf_get_stats(&stats);
+    cr_assert(stats.trimmed_bytes >= 80000, "Too few bytes trimmed");
+    assert_free_block_count(0, 1); // the wilderness is still one free block
+
+    x = sf_malloc(90000);
+    cr_assert_not_null(x, "The trimmed block could not be allocated!");
+    memset(x, 'y', 90000);
+    sf_free(x);
+
+    // with the threshold set, the free that leaves a large wilderness trims it
+    cr_assert(sf_mallopt(SF_OPT_TRIM_THRESHOLD, 16384) == 1, "sf_mallopt failed!");
+    size_t trimmed = stats.trimmed_bytes;
+    x = sf_malloc(60000);
+    memset(x, 'z', 60000);
+    sf_free(x);
+    sf_get_stats(&stats);
+    cr_assert(stats.trimmed_bytes > trimmed, "The free did not trim the heap!");
+
+    // a small block taken from the front and freed again doesn't trim the same pages again
+    trimmed = stats.trimmed_bytes;
+    sf_free(sf_malloc(100));
+    sf_get_stats(&stats);
+    cr_assert_eq(stats.trimmed_bytes, trimmed, "The same pages were trimmed again!");
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_31, .timeout = TEST_TIMEOUT) {
+    // shrinking marks the tail free in the block after it, so freeing that block merges with it
+    sf_errno = 0;
+    char *x = sf_malloc(200);
+    char *y = sf_malloc(10);
+    cr_assert(sf_realloc(x, 50) == x, "The block moved!");
+    sf_block *bp = (sf_block *)(y - sizeof(sf_header));
+    cr_assert((bp->header & 0x8) == 0, "Prev allocated bit is still set!");
+    sf_free(y);
+    assert_free_block_count(0, 1);
+
+    // a tail next to a free block becomes one free block with it
+    sf_free(x);
+    x = sf_malloc(200);
+    y = sf_malloc(200);
+    char *z = sf_malloc(10);
+    sf_free(y);
+    cr_assert(sf_realloc(x, 50) == x, "The block moved!");
+    assert_free_block_count(384, 1);
+
+    // within the slack, a buffer shrinks and grows back without leaving its block
+    cr_assert(sf_mallopt(SF_OPT_REALLOC_SLACK, 256) == 1, "sf_mallopt failed!");
+    char *w = sf_malloc(300);
+    cr_assert(sf_realloc(w, 100) == w, "The block moved!");
+    bp = (sf_block *)(w - sizeof(sf_header));
+    cr_assert((bp->header & ~0x1f) == 320, "The block was split!");
+    cr_assert(sf_realloc(w, 300) == w, "The block moved!");
+    cr_assert(sf_realloc(w, 100) == w, "The block moved!");
+    sf_free_sized(w, 100);
+    sf_free(z);
+    sf_free(x);
+    assert_free_block_count(0, 1);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_32, .timeout = TEST_TIMEOUT) {
+    // a heap on the caller's buffer grows past the sfutil limit and stays inside the buffer
+    static char buffer[512 * 1024];
+    sf_errno = 0;
+    sf_page_config config = {SF_PAGES_STATIC, 65536, sizeof(buffer), buffer, NULL};
+    cr_assert(sf_set_page_provider(&config) == 1, "sf_set_page_provider failed!");
+    cr_assert(sf_mallopt(SF_OPT_MMAP_THRESHOLD, 0) == 1, "sf_mallopt failed!");
+
+    char *x = sf_malloc(120000);
+    char *y = sf_malloc(200000);
+    cr_assert_not_null(x, "x is NULL!");
+    cr_assert_not_null(y, "y is NULL!");
+    cr_assert(x >= buffer && y + 200000 <= buffer + sizeof(buffer), "The heap is outside the buffer!");
+    cr_assert((y - x) % 32 == 0 && ((uintptr_t)x & 0x1F) == 0, "Payloads are misaligned!");
+    memset(y, 'y', 200000);
+
+    sf_stats stats;
+    sf_get_stats(&stats);
+    cr_assert(stats.heap_size % 65536 == 0, "The heap did not grow by whole pages!");
+
+    // the buffer runs out like any other heap
+    cr_assert_null(sf_malloc(300000), "The heap grew past the buffer!");
+    cr_assert(sf_errno == ENOMEM, "sf_errno is not ENOMEM!");
+
+    // the provider can't change under an existing heap
+    sf_errno = 0;
+    config.provider = SF_PAGES_MMAP;
+    cr_assert(sf_set_page_provider(&config) == 0, "The provider changed!");
+    cr_assert(sf_errno == EINVAL, "sf_errno is not EINVAL!");
+    sf_free(x);
+    sf_free(y);
+}
+
+Test(sfmm_student_suite, student_test_33, .timeout = TEST_TIMEOUT) {
+    // with a rate of one byte every allocation is sampled, and frees retire their samples
+    sf_errno = 0;
+    cr_assert(sf_profile_dump(1) == 0 && sf_errno == EINVAL, "A profile was dumped before profiling started!");
+    sf_errno = 0;
+    cr_assert(sf_mallopt(SF_OPT_SLAB, 1) == 1, "sf_mallopt failed!");
+    cr_assert(sf_mallopt(SF_OPT_PROFILE_RATE, 1) == 1, "sf_mallopt failed!");
+
+    char *x = sf_malloc(40); // small enough for a slab, but sampled blocks have a header
+    char *y = sf_malloc(500);
+    char *z = sf_memalign(300, 256);
+    sf_block *bp = (sf_block *)(x - sizeof(sf_header));
+    cr_assert(bp->header & 0x1, "The block was not sampled!");
+    sf_free(y);
+    cr_assert(sf_mallopt(SF_OPT_PROFILE_RATE, 0) == 1, "sf_mallopt failed!");
+    sf_free(sf_malloc(1000)); // not sampled
+
+    char path[] = "sfmm_profile_test.heap";
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    cr_assert(fd >= 0, "Could not open the profile file!");
+    cr_assert(sf_profile_dump(fd) == 1, "sf_profile_dump failed!");
+
+    char text[128] = {0};
+    lseek(fd, 0, SEEK_SET);
+    cr_assert(read(fd, text, sizeof(text) - 1) > 0, "The profile is empty!");
+    close(fd);
+    unlink(path);
+    const char *header = "heap profile: 2: 340 [3: 840] @ heap_v2/1\n"; // x and z are live, y was freed
+    cr_assert(strncmp(text, header, strlen(header)) == 0, "Wrong profile header: %s", text);
+
+    sf_free(x);
+    sf_free(z);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_34, .timeout = TEST_TIMEOUT) {
+    // the usable size is the block minus its header, or the whole slab object
+    sf_errno = 0;
+    cr_assert(sf_usable_size(NULL) == 0, "NULL has a usable size!");
+    char *x = sf_malloc(100);
+    cr_assert(sf_usable_size(x) == 120, "Wrong usable size %zu for a 128 byte block!", sf_usable_size(x));
+    memset(x, 1, sf_usable_size(x));
+
+    cr_assert(sf_mallopt(SF_OPT_SLAB, 1) == 1, "sf_mallopt failed!");
+    char *y = sf_malloc(40);
+    cr_assert(sf_usable_size(y) == 64, "Wrong usable size %zu for a 64 byte slab object!", sf_usable_size(y));
+
+    sf_free(y);
+    sf_free(x);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_35, .timeout = TEST_TIMEOUT) {
+    // calloc'd memory is zero whether it comes from fresh pages, freed blocks or a mapping
+    sf_page_config config = {SF_PAGES_MMAP, 0, 0, NULL, NULL};
+    cr_assert(sf_set_page_provider(&config) == 1, "sf_set_page_provider failed!");
+    sf_errno = 0;
+    cr_assert(sf_calloc(0, 10) == NULL && sf_errno == 0, "sf_calloc of nothing returned memory!");
+    cr_assert(sf_calloc(SIZE_MAX / 2, 4) == NULL && sf_errno == ENOMEM, "An overflowing sf_calloc succeeded!");
+    sf_errno = 0;
+
+    char *x = sf_malloc(3000);
+    memset(x, 0xAB, 3000);
+    char *y = sf_calloc(100, 30);
+    for (int i = 0; i < 3000; i++) cr_assert(y[i] == 0, "Byte %d of fresh memory is not zero!", i);
+    sf_free(x);
+    sf_free(y);
+
+    char *z = sf_calloc(2, 2900); // spans the freed blocks and fresh memory past them
+    for (int i = 0; i < 5800; i++) cr_assert(z[i] == 0, "Byte %d of reused memory is not zero!", i);
+    char *w = sf_calloc(1, 200000); // mapped
+    for (int i = 0; i < 200000; i += 1000) cr_assert(w[i] == 0, "Byte %d of mapped memory is not zero!", i);
+
+    sf_stats stats;
+    sf_get_stats(&stats);
+    cr_assert(stats.calloc_calls == 5 && stats.failed_allocations == 1, "Wrong number of calls counted!");
+    sf_free(z);
+    sf_free(w);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+#define CHURN_THREADS 4
+#define CHURN_SLOTS 2
+#define CHURN_ROUNDS 20000
+
+/*
+ * Keeps CHURN_SLOTS blocks of random sizes live, replacing one at a time, so nearly every free
+ * coalesces with the rest of the heap.  Returns the number of allocations that failed.
+ */
+static void *churn_worker(void *arg) {
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    void *slots[CHURN_SLOTS] = {NULL};
+    uintptr_t failures = 0;
+
+    for (int round = 0; round < CHURN_ROUNDS; round++) {
+        seed = seed * 1103515245 + 12345;
+        int slot = (seed >> 16) % CHURN_SLOTS;
+        if (slots[slot] != NULL) sf_free(slots[slot]);
+        slots[slot] = sf_malloc(1 + (seed >> 8) % 4000);
+        if (slots[slot] == NULL) failures++;
+    }
+    for (int slot = 0; slot < CHURN_SLOTS; slot++) {
+        if (slots[slot] != NULL) sf_free(slots[slot]);
+    }
+    return (void *)failures;
+}
+
+Test(sfmm_student_suite, student_test_36, .timeout = TEST_TIMEOUT) {
+    // a small live set never runs out of memory, even while other threads are coalescing their frees
+    sf_mallopt(SF_OPT_TCACHE, 0);
+    uintptr_t failures = 0;
+#ifdef SF_THREADS
+    pthread_t threads[CHURN_THREADS];
+    for (int i = 0; i < CHURN_THREADS; i++) pthread_create(&threads[i], NULL, churn_worker, (void *)(uintptr_t)(i + 1));
+    for (int i = 0; i < CHURN_THREADS; i++) {
+        void *thread_failures;
+        pthread_join(threads[i], &thread_failures);
+        failures += (uintptr_t)thread_failures;
+    }
+#else
+    for (int i = 0; i < CHURN_THREADS; i++) failures += (uintptr_t)churn_worker((void *)(uintptr_t)(i + 1));
+#endif
+    cr_assert(failures == 0, "%lu allocations failed!", (unsigned long)failures);
+}
+
+Test(sfmm_student_suite, student_test_37, .timeout = TEST_TIMEOUT) {
+    // small requests still succeed once the heap outgrows the part the slab page map covers,
+    // and don't keep taking a slab block off the heap just to give it back
+    sf_page_config config = {SF_PAGES_MMAP, 0, 0, NULL, NULL};
+    cr_assert(sf_set_page_provider(&config) == 1, "sf_set_page_provider failed!");
+    sf_errno = 0;
+
+    void *big[30];
+    for (int i = 0; i < 30; i++) {
+        big[i] = sf_malloc(100000); // below the mmap threshold, so the heap grows past 2MB
+        cr_assert_not_null(big[i], "big[%d] is NULL!", i);
+    }
+    cr_assert((char *)heap_mem_end() - (char *)heap_mem_start() > SLAB_PAGE_MAP_PAGES * PAGE_SZ, "The heap is too small!");
+
+    sf_mallopt(SF_OPT_SLAB, 1);
+    char *x = sf_malloc(16);
+    cr_assert_not_null(x, "x is NULL!");
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+    memset(x, 0xAB, 16);
+    sf_free(x);
+
+    sf_stats before, after;
+    sf_get_stats(&before);
+    for (int i = 0; i < 1000; i++) {
+        x = sf_malloc(16);
+        cr_assert_not_null(x, "x is NULL!");
+        sf_free(x);
+    }
+    sf_get_stats(&after);
+    // one split off the free space at the end of the heap per malloc, one coalesce back per free
+    cr_assert(after.splits - before.splits <= 1000, "%zu splits for 1000 mallocs!", after.splits - before.splits);
+    cr_assert(after.coalesces - before.coalesces <= 1000, "%zu coalesces for 1000 frees!", after.coalesces - before.coalesces);
+
+    for (int i = 0; i < 30; i++) sf_free(big[i]);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}
+
+Test(sfmm_student_suite, student_test_38, .timeout = TEST_TIMEOUT) {
+    // the parts an aligned allocation splits off are released, not handed out, so they stay known to be zero
+    sf_page_config config = {SF_PAGES_MMAP, 65536, 0, NULL, NULL};
+    cr_assert(sf_set_page_provider(&config) == 1, "sf_set_page_provider failed!");
+    sf_errno = 0;
+
+    char *x = sf_memalign(100, 4096);
+    cr_assert_not_null(x, "x is NULL!");
+    cr_assert(((uintptr_t)x & 4095) == 0, "x is not aligned!");
+    cr_assert(sf_zero_watermark < x + 4096 && (char *)heap_mem_end() - sf_zero_watermark > 32768,
+              "The zero watermark went past the aligned block!");
+
+    char *y = sf_calloc(1000, 40);
+    for (int i = 0; i < 40000; i++) cr_assert(y[i] == 0, "Byte %d is not zero!", i);
+    sf_free(x);
+    sf_free(y);
+    cr_assert(sf_errno == 0, "sf_errno is not zero!");
+}